@@ -1,7 +1,12 @@
+#ifndef FUTEX_WRAPPER_H
+#define FUTEX_WRAPPER_H
+
 #include <atomic>
 #include <cassert>
 #include <chrono>
+#include <climits>
 #include <cstdint>
+#include <ctime>
 #include <limits>
 #include <type_traits>
 
@@ -35,18 +40,24 @@
 
 #ifdef __linux__
 
-int futex_wait(uint32_t* uaddr, uint32_t val) {
+inline int futex_wait(uint32_t* uaddr, uint32_t val) {
   static constexpr timespec timeout = {2, 0};
-  return syscall(SYS_futex, ptr, FUTEX_WAIT_PRIVATE, val, &timeout, 0, 0);
+  return syscall(SYS_futex, uaddr, FUTEX_WAIT_PRIVATE, val, &timeout, 0, 0);
+}
+
+// Same as above, with a relative timeout. A null timeout waits forever.
+// Returns -1 with errno set to ETIMEDOUT if the timeout expires.
+inline int futex_wait(uint32_t* uaddr, uint32_t val, const timespec* timeout) {
+  return syscall(SYS_futex, uaddr, FUTEX_WAIT_PRIVATE, val, timeout, 0, 0);
 }
 
-int futex_wake(uint32_t* uaddr, int val) {
+inline int futex_wake(uint32_t* uaddr, int val) {
   return syscall(SYS_futex, uaddr, FUTEX_WAKE, val, 0, 0, 0);
 }
 
-int futex_wake(uint32_t* uaddr, bool notify_one) {
-  syscall(SYS_futex, ptr, FUTEX_WAKE_PRIVATE, notify_one ? 1 : INT_MAX, 0, 0,
-          0);
+inline int futex_wake(uint32_t* uaddr, bool notify_one) {
+  return syscall(SYS_futex, uaddr, FUTEX_WAKE_PRIVATE, notify_one ? 1 : INT_MAX,
+                 0, 0, 0);
 }
 
 #elif defined(__APPLE__)
@@ -63,15 +74,25 @@ extern "C" int __ulock_wake(uint32_t operation,
 #define UL_COMPARE_AND_WAIT 1
 #define ULF_WAKE_ALL 0x00000100
 
-int futex_wait(uint32_t* uaddr, uint32_t val) {
+inline int futex_wait(uint32_t* uaddr, uint32_t val) {
   return __ulock_wait(UL_COMPARE_AND_WAIT, uaddr, val, 0);
 }
 
-int futex_wake(uint32_t* uaddr, int val) {
+inline int futex_wait(uint32_t* uaddr, uint32_t val, const timespec* timeout) {
+  uint32_t us = 0;
+  if (timeout) {
+    // Zero means forever to __ulock_wait, so round up to at least 1us
+    const auto total = timeout->tv_sec * 1000000 + timeout->tv_nsec / 1000;
+    us = total > 0 ? static_cast<uint32_t>(total) : 1;
+  }
+  return __ulock_wait(UL_COMPARE_AND_WAIT, uaddr, val, us);
+}
+
+inline int futex_wake(uint32_t* uaddr, int val) {
   return __ulock_wake(UL_COMPARE_AND_WAIT, uaddr, val);
 }
 
-int futex_wake(uint32_t* uaddr, bool notify_one) {
+inline int futex_wake(uint32_t* uaddr, bool notify_one) {
   return __ulock_wake(UL_COMPARE_AND_WAIT | (notify_one ? 0 : ULF_WAKE_ALL),
                       uaddr, 0);
 }
@@ -79,3 +100,5 @@ int futex_wake(uint32_t* uaddr, bool notify_one) {
 #else  // <- Add other operating systems here
 
 #endif
+
+#endif  // FUTEX_WRAPPER_H
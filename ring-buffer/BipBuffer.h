@@ -0,0 +1,196 @@
+#pragma once
+
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <optional>
+#include <span>
+#include <stdexcept>
+
+// Lock-free single producer single consumer queue of variable-length byte
+// messages, stored back to back in one buffer instead of a slot each. Each
+// message is a length header followed by its bytes, padded to kAlign. A
+// message that doesn't fit between its position and the end of the buffer
+// starts over at the beginning (leaving a marker behind), as in Simon
+// Cooke's bip-buffer, so that every message is contiguous: the producer
+// writes it in place and the consumer reads it in place.
+//
+// Positions count bytes from the start and never wrap. The offset in the
+// buffer is the position modulo its size, which is a power of two.
+class BipBuffer {
+#ifdef __cpp_lib_hardware_interference_size
+  static constexpr size_t kCacheLineSize =
+      std::hardware_destructive_interference_size;
+#else
+  static constexpr size_t kCacheLineSize = 64;
+#endif
+  // Headers and message starts are aligned to this, which is also the size
+  // of a header
+  static constexpr size_t kAlign = 8;
+  // The length in the header of a marker that says to go back to the start
+  static constexpr uint32_t kWrap = UINT32_MAX;
+  using AtomicIndex = std::atomic<size_t>;
+
+  char pad0_[kCacheLineSize];
+  const size_t size_;
+  std::byte* const bytes_;
+
+  alignas(kCacheLineSize) AtomicIndex readIndex_{0};
+  alignas(kCacheLineSize) AtomicIndex writeIndex_{0};
+  // Where the reserved message starts (past the marker, if it wraps), and
+  // how long it may be. Only the producer touches them.
+  size_t reservedAt_{0};
+  size_t reservedLength_{0};
+
+  char pad1_[kCacheLineSize - sizeof(AtomicIndex) - 2 * sizeof(size_t)];
+
+  // Bytes a message of that length takes up, header included
+  static size_t footprint(size_t length) {
+    return kAlign + (length + kAlign - 1) / kAlign * kAlign;
+  }
+
+  size_t offset(size_t position) const { return position & (size_ - 1); }
+
+  uint32_t header(size_t position) const {
+    uint32_t length;
+    std::memcpy(&length, bytes_ + offset(position), sizeof(length));
+    return length;
+  }
+
+  void setHeader(size_t position, uint32_t length) {
+    std::memcpy(bytes_ + offset(position), &length, sizeof(length));
+  }
+
+  // Skips the marker at position, if there is one. There is always a message
+  // after a marker: they're published together.
+  size_t skipWrap(size_t position) const {
+    if (header(position) == kWrap) {
+      position += size_ - offset(position);
+    }
+    return position;
+  }
+
+  std::span<const std::byte> message(size_t position) const {
+    return {bytes_ + offset(position) + kAlign, header(position)};
+  }
+
+ public:
+  // Avoid copying
+  BipBuffer(const BipBuffer&) = delete;
+  BipBuffer& operator=(const BipBuffer&) = delete;
+
+  // size is in bytes, and must be a power of two. Messages also use up a
+  // header and padding each.
+  explicit BipBuffer(size_t size)
+      : size_(size), bytes_(static_cast<std::byte*>(std::malloc(size))) {
+    assert(size >= 2 * kAlign && std::has_single_bit(size));
+    if (!bytes_) {
+      throw std::bad_alloc();
+    }
+  }
+
+  ~BipBuffer() { std::free(bytes_); }
+
+  bool empty() const {
+    return readIndex_.load(std::memory_order_acquire) ==
+           writeIndex_.load(std::memory_order_acquire);
+  }
+
+  // Bytes in use, headers, padding and markers included. Same caveats as
+  // RingBuffer::sizeEstimate.
+  size_t sizeEstimate() const {
+    const auto read = readIndex_.load(std::memory_order_acquire);
+    return writeIndex_.load(std::memory_order_acquire) - read;
+  }
+
+  // The longest message that always fits once the buffer is empty. Longer
+  // ones could fit at some offsets but never at others: an empty buffer whose
+  // next write is mid-buffer only has room for max(offset, size - offset)
+  // bytes in one piece. This one takes up at most half of it, so it fits on
+  // one side or the other.
+  size_t capacity() const { return size_ / 2 - kAlign; }
+
+  // Returns where to write a message of up to length bytes, or nullptr if
+  // there's no room for it right now (or ever, if it's longer than
+  // capacity()). commit publishes it.
+  std::byte* reserve(size_t length) {
+    if (length > capacity()) {
+      return nullptr;
+    }
+    const auto currentWrite = writeIndex_.load(std::memory_order_relaxed);
+    const auto currentRead = readIndex_.load(std::memory_order_acquire);
+    const auto untilEnd = size_ - offset(currentWrite);
+    const auto skip = untilEnd < footprint(length) ? untilEnd : 0;
+    if (currentWrite + skip + footprint(length) - currentRead > size_) {
+      // The buffer is full
+      return nullptr;
+    }
+    if (skip != 0) {
+      // Offsets are multiples of kAlign, so there's room for the marker.
+      setHeader(currentWrite, kWrap);
+    }
+    reservedAt_ = currentWrite + skip;
+    reservedLength_ = length;
+    return bytes_ + offset(reservedAt_) + kAlign;
+  }
+
+  // Publishes the message from the last reserve, which may have come out
+  // shorter than the room it reserved.
+  void commit(size_t length) {
+    assert(length <= reservedLength_);
+    setHeader(reservedAt_, static_cast<uint32_t>(length));
+    writeIndex_.store(reservedAt_ + footprint(length),
+                      std::memory_order_release);
+  }
+
+  // Copies message in. Returns false if there's no room for it.
+  bool push(std::span<const std::byte> message) {
+    auto* bytes = reserve(message.size());
+    if (!bytes) {
+      return false;
+    }
+    if (!message.empty()) {
+      std::memcpy(bytes, message.data(), message.size());
+    }
+    commit(message.size());
+    return true;
+  }
+
+  // The message at the front of the queue, in place, if there is one. It
+  // stays valid until pop.
+  std::optional<std::span<const std::byte>> front() const {
+    const auto currentRead = readIndex_.load(std::memory_order_relaxed);
+    if (currentRead == writeIndex_.load(std::memory_order_acquire)) {
+      return std::nullopt;
+    }
+    return message(skipWrap(currentRead));
+  }
+
+  // Removes the message at the front of the queue, which must be there.
+  void pop() {
+    const auto currentRead =
+        skipWrap(readIndex_.load(std::memory_order_relaxed));
+    readIndex_.store(currentRead + footprint(header(currentRead)),
+                     std::memory_order_release);
+  }
+
+  // Calls fn(message) on every message in the queue, in place, then frees
+  // them all with a single index store. Returns how many there were.
+  template <class F>
+  size_t consume_all(F&& fn) {
+    const auto currentWrite = writeIndex_.load(std::memory_order_acquire);
+    size_t n = 0;
+    for (auto position = readIndex_.load(std::memory_order_relaxed);
+         position != currentWrite; ++n) {
+      position = skipWrap(position);
+      fn(message(position));
+      position += footprint(header(position));
+    }
+    readIndex_.store(currentWrite, std::memory_order_release);
+    return n;
+  }
+};
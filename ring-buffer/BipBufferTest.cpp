@@ -0,0 +1,111 @@
+#include <cstddef>
+#include <cstring>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "BipBuffer.h"
+
+static std::span<const std::byte> Bytes(const std::string& s) {
+  return std::as_bytes(std::span(s));
+}
+
+static std::string String(std::span<const std::byte> bytes) {
+  return {reinterpret_cast<const char*>(bytes.data()), bytes.size()};
+}
+
+TEST(BipBuffer, SimpleBipBufferTest) {
+  BipBuffer ring(64);
+  EXPECT_TRUE(ring.empty());
+  EXPECT_FALSE(ring.front());
+  EXPECT_TRUE(ring.push(Bytes("hello")));
+  EXPECT_TRUE(ring.push(Bytes("")));
+  EXPECT_TRUE(ring.push(Bytes("world!")));
+  // 16 + 8 + 16 bytes are used, and 32 would be needed.
+  EXPECT_FALSE(ring.push(Bytes(std::string(20, 'x'))));
+
+  EXPECT_EQ(String(*ring.front()), "hello");
+  ring.pop();
+  EXPECT_EQ(String(*ring.front()), "");
+  ring.pop();
+  EXPECT_EQ(String(*ring.front()), "world!");
+  ring.pop();
+  EXPECT_TRUE(ring.empty());
+  EXPECT_FALSE(ring.push(Bytes(std::string(ring.capacity() + 1, 'x'))));
+}
+
+TEST(BipBuffer, WrapsToStartBipBufferTest) {
+  BipBuffer ring(64);
+  EXPECT_TRUE(ring.push(Bytes(std::string(20, 'a'))));  // [0, 32)
+  EXPECT_TRUE(ring.push(Bytes(std::string(8, 'b'))));   // [32, 48)
+  ring.pop();
+  // 24 bytes don't fit in the 16 left at the end, so they go at the start.
+  std::byte* bytes = ring.reserve(24);
+  ASSERT_NE(bytes, nullptr);
+  std::memset(bytes, 'c', 24);
+  // Only use part of it
+  ring.commit(10);
+
+  std::vector<std::string> seen;
+  auto collect = [&](std::span<const std::byte> message) {
+    seen.push_back(String(message));
+  };
+  EXPECT_EQ(ring.consume_all(collect), 2u);
+  EXPECT_EQ(seen, (std::vector<std::string>{std::string(8, 'b'),
+                                            std::string(10, 'c')}));
+  EXPECT_TRUE(ring.empty());
+}
+
+TEST(BipBuffer, CapacityFitsAtAnyOffsetBipBufferTest) {
+  BipBuffer ring(64);
+  // Drain the buffer at every offset, then fill it with the longest message.
+  for (size_t length = 0; length != 64; length += 8) {
+    EXPECT_TRUE(ring.push(Bytes(std::string(length % 24, 'a'))));
+    ring.pop();
+    ASSERT_TRUE(ring.empty());
+    std::byte* bytes = ring.reserve(ring.capacity());
+    ASSERT_NE(bytes, nullptr);
+    std::memset(bytes, 'b', ring.capacity());
+    ring.commit(ring.capacity());
+    EXPECT_EQ(String(*ring.front()), std::string(ring.capacity(), 'b'));
+    ring.pop();
+  }
+}
+
+TEST(BipBuffer, ConcurrentBipBufferTest) {
+  const size_t numMessages = 1 << 16;
+  BipBuffer ring(1 << 14);
+  // Messages of 16 bytes to 4KB, filled with their index
+  auto length = [](size_t i) { return 16 + i * 7919 % 4081; };
+  std::thread producer([&] {
+    for (size_t i = 0; i < numMessages;) {
+      if (auto* bytes = ring.reserve(length(i))) {
+        std::memset(bytes, static_cast<int>(i % 251), length(i));
+        ring.commit(length(i));
+        i++;
+      }
+    }
+  });
+  size_t next = 0;
+  bool intact = true;
+  while (next < numMessages) {
+    ring.consume_all([&](std::span<const std::byte> message) {
+      intact &= message.size() == length(next);
+      for (auto b : message) {
+        intact &= b == static_cast<std::byte>(next % 251);
+      }
+      next++;
+    });
+  }
+  producer.join();
+  EXPECT_TRUE(intact);
+  EXPECT_TRUE(ring.empty());
+}
+
+int main(int argc, char* argv[]) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Lock-free single producer single consumer queue, like RingBuffer, but with
+// its capacity fixed at compile time:
+//
+// * Capacity is a power of two, so indices wrap with a mask instead of a
+//   compare and reset. The indices themselves never wrap (well, not for
+//   centuries), so all Capacity slots are usable: full is write - read ==
+//   Capacity, rather than one slot always being kept empty.
+// * Each side keeps a copy of the other side's index, and only reloads it
+//   when the queue looks full (to the producer) or empty (to the consumer).
+//   In steady state a push or a pop then touches no cache line the other
+//   core writes to, other than the slot itself.
+// * The slots are stored inline, starting on a cache line of their own.
+template <class T, size_t Capacity>
+struct FixedRingBuffer {
+  static_assert(std::has_single_bit(Capacity),
+                "Capacity must be a power of two");
+
+ private:
+#ifdef __cpp_lib_hardware_interference_size
+  static constexpr size_t kCacheLineSize =
+      std::hardware_destructive_interference_size;
+#else
+  static constexpr size_t kCacheLineSize = 64;
+#endif
+  static constexpr size_t kMask = Capacity - 1;
+  using AtomicIndex = std::atomic<size_t>;
+
+  struct alignas(T) Slot {
+    std::byte data[sizeof(T)];
+  };
+
+  // Written by the consumer
+  alignas(kCacheLineSize) AtomicIndex readIndex_{0};
+  size_t cachedWrite_{0};
+  // Written by the producer
+  alignas(kCacheLineSize) AtomicIndex writeIndex_{0};
+  size_t cachedRead_{0};
+
+  alignas(kCacheLineSize) Slot records_[Capacity];
+
+  char pad_[kCacheLineSize];
+
+  T* slot(size_t index) {
+    return std::launder(reinterpret_cast<T*>(records_[index & kMask].data));
+  }
+
+ public:
+  typedef T value_type;
+
+  FixedRingBuffer() = default;
+
+  // Avoid copying
+  FixedRingBuffer(const FixedRingBuffer&) = delete;
+  FixedRingBuffer& operator=(const FixedRingBuffer&) = delete;
+
+  ~FixedRingBuffer() {
+    // No real synchronization needed at destructor time: only one
+    // thread can be doing this.
+    if (!std::is_trivially_destructible<T>::value) {
+      const size_t endIndex = writeIndex_.load(std::memory_order_relaxed);
+      for (size_t readIndex = readIndex_.load(std::memory_order_relaxed);
+           readIndex != endIndex; ++readIndex) {
+        slot(readIndex)->~T();
+      }
+    }
+  }
+
+  bool empty() const {
+    return readIndex_.load(std::memory_order_acquire) ==
+           writeIndex_.load(std::memory_order_acquire);
+  }
+
+  bool full() const { return sizeEstimate() == Capacity; }
+
+  // Same caveats as RingBuffer::sizeEstimate.
+  size_t sizeEstimate() const {
+    const auto read = readIndex_.load(std::memory_order_acquire);
+    return writeIndex_.load(std::memory_order_acquire) - read;
+  }
+
+  // Maximum number of items in the queue.
+  static constexpr size_t capacity() { return Capacity; }
+
+  template <class... Args>
+  bool push(Args&&... recordArgs) {
+    const auto currentWrite = writeIndex_.load(std::memory_order_relaxed);
+    if (currentWrite - cachedRead_ == Capacity) {
+      cachedRead_ = readIndex_.load(std::memory_order_acquire);
+      if (currentWrite - cachedRead_ == Capacity) {
+        // The queue is full
+        return false;
+      }
+    }
+    new (records_[currentWrite & kMask].data)
+        T(std::forward<Args>(recordArgs)...);
+    writeIndex_.store(currentWrite + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool pop(T& record) {
+    auto* current = front();
+    if (!current) {
+      return false;
+    }
+    record = std::move(*current);
+    current->~T();
+    readIndex_.store(readIndex_.load(std::memory_order_relaxed) + 1,
+                     std::memory_order_release);
+    return true;
+  }
+
+  // Returns a pointer to the value at the front of the queue (for use in-place)
+  T* front() {
+    const auto currentRead = readIndex_.load(std::memory_order_relaxed);
+    if (currentRead == cachedWrite_) {
+      cachedWrite_ = writeIndex_.load(std::memory_order_acquire);
+      if (currentRead == cachedWrite_) {
+        // The queue is empty
+        return nullptr;
+      }
+    }
+    return slot(currentRead);
+  }
+};
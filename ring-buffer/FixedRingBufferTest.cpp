@@ -0,0 +1,83 @@
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "gtest/gtest.h"
+
+#include "FixedRingBuffer.h"
+
+TEST(FixedRingBuffer, SimpleRingBufferTest) {
+  FixedRingBuffer<int, 16> ring;
+  EXPECT_TRUE(ring.empty());
+  EXPECT_EQ(ring.front(), nullptr);
+  EXPECT_TRUE(ring.push(1));
+  EXPECT_EQ(*ring.front(), 1);
+
+  int value;
+  EXPECT_TRUE(ring.pop(value));
+  EXPECT_EQ(value, 1);
+  EXPECT_TRUE(ring.empty());
+  EXPECT_FALSE(ring.pop(value));
+}
+
+TEST(FixedRingBuffer, UsesEverySlotTest) {
+  FixedRingBuffer<int, 8> ring;
+  // Go around a few times, so that the indices wrap past the slots.
+  for (int round = 0; round < 5; round++) {
+    for (int i = 0; i < 8; i++) {
+      EXPECT_TRUE(ring.push(round * 8 + i));
+    }
+    EXPECT_TRUE(ring.full());
+    EXPECT_EQ(ring.sizeEstimate(), 8u);
+    EXPECT_FALSE(ring.push(0));
+
+    for (int i = 0; i < 8; i++) {
+      int value;
+      EXPECT_TRUE(ring.pop(value));
+      EXPECT_EQ(value, round * 8 + i);
+    }
+    EXPECT_TRUE(ring.empty());
+  }
+}
+
+TEST(FixedRingBuffer, DestroysRecordsTest) {
+  auto counted = std::make_shared<int>(0);
+  {
+    FixedRingBuffer<std::shared_ptr<int>, 4> ring;
+    for (int i = 0; i < 3; i++) {
+      EXPECT_TRUE(ring.push(counted));
+    }
+    std::shared_ptr<int> value;
+    EXPECT_TRUE(ring.pop(value));
+    value.reset();
+    EXPECT_EQ(counted.use_count(), 3);
+  }
+  EXPECT_EQ(counted.use_count(), 1);
+}
+
+TEST(FixedRingBuffer, ConcurrentRingBufferTest) {
+  const size_t numItems = 1 << 20;
+  auto ring = std::make_unique<FixedRingBuffer<size_t, 1024>>();
+  std::thread producer([&] {
+    for (size_t i = 0; i < numItems;) {
+      if (ring->push(i)) {
+        i++;
+      }
+    }
+  });
+  bool ordered = true;
+  for (size_t i = 0; i < numItems;) {
+    size_t value;
+    if (ring->pop(value)) {
+      ordered &= value == i++;
+    }
+  }
+  producer.join();
+  EXPECT_TRUE(ordered);
+  EXPECT_TRUE(ring->empty());
+}
+
+int main(int argc, char* argv[]) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
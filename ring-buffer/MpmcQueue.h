@@ -0,0 +1,103 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+#include "SequencedSlots.h"
+
+// Lock-free multi producer multi consumer queue with a fixed capacity, after
+// Dmitry Vyukov's bounded MPMC queue (see SequencedSlots.h). Producers and
+// consumers only contend on their own end's ticket counter, and then on the
+// one slot they got, never on a lock.
+//
+// The try_ variants take a ticket only if its slot is ready, and fail if the
+// queue is full (or empty). The others take the next ticket right away and
+// then wait for the slot, spinning and then yielding, so they don't fail but
+// don't sleep either.
+template <class T>
+class MpmcQueue {
+#ifdef __cpp_lib_hardware_interference_size
+  static constexpr size_t kCacheLineSize =
+      std::hardware_destructive_interference_size;
+#else
+  static constexpr size_t kCacheLineSize = 64;
+#endif
+  using Slots = SequencedSlots<T>;
+  using AtomicIndex = typename Slots::AtomicIndex;
+
+  char pad0_[kCacheLineSize];
+  Slots slots_;
+
+  alignas(kCacheLineSize) AtomicIndex writeIndex_{0};
+  alignas(kCacheLineSize) AtomicIndex readIndex_{0};
+
+  char pad1_[kCacheLineSize - sizeof(AtomicIndex)];
+
+ public:
+  typedef T value_type;
+
+  // Avoid copying
+  MpmcQueue(const MpmcQueue&) = delete;
+  MpmcQueue& operator=(const MpmcQueue&) = delete;
+
+  // Unlike RingBuffer, every slot is usable, but there must be a power of two
+  // of them.
+  explicit MpmcQueue(uint32_t size) : slots_(size) {}
+
+  ~MpmcQueue() {
+    // No real synchronization needed at destructor time: only one
+    // thread can be doing this.
+    slots_.destroy(readIndex_.load(std::memory_order_relaxed),
+                   writeIndex_.load(std::memory_order_relaxed));
+  }
+
+  bool empty() const { return sizeEstimate() == 0; }
+
+  // May be off while other threads push or pop.
+  size_t sizeEstimate() const {
+    const auto read = readIndex_.load(std::memory_order_acquire);
+    const auto write = writeIndex_.load(std::memory_order_acquire);
+    // Blocked pushes and pops take tickets ahead of their slots.
+    return write > read ? std::min(write - read, capacity()) : 0;
+  }
+
+  // Maximum number of items in the queue.
+  size_t capacity() const { return slots_.size(); }
+
+  // Returns false if the queue is full.
+  template <class... Args>
+  bool try_push(Args&&... recordArgs) {
+    auto* slot = slots_.claim(writeIndex_, 0);
+    if (!slot) {
+      return false;
+    }
+    Slots::put(*slot, std::forward<Args>(recordArgs)...);
+    return true;
+  }
+
+  // Returns false if the queue is empty.
+  bool try_pop(T& record) {
+    auto* slot = slots_.claim(readIndex_, 1);
+    if (!slot) {
+      return false;
+    }
+    slots_.take(*slot, record);
+    return true;
+  }
+
+  // Waits for room if the queue is full.
+  template <class... Args>
+  void push(Args&&... recordArgs) {
+    const auto ticket = writeIndex_.fetch_add(1, std::memory_order_relaxed);
+    Slots::put(slots_.wait(ticket, 0), std::forward<Args>(recordArgs)...);
+  }
+
+  // Waits for a record if the queue is empty.
+  void pop(T& record) {
+    const auto ticket = readIndex_.fetch_add(1, std::memory_order_relaxed);
+    slots_.take(slots_.wait(ticket, 1), record);
+  }
+};
@@ -0,0 +1,97 @@
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "MpmcQueue.h"
+
+TEST(MpmcQueue, SimpleQueueTest) {
+  MpmcQueue<int> queue(4);
+  EXPECT_TRUE(queue.empty());
+  int value;
+  EXPECT_FALSE(queue.try_pop(value));
+
+  // Every slot is usable, lap after lap.
+  for (int round = 0; round < 3; round++) {
+    for (int i = 0; i < 4; i++) {
+      EXPECT_TRUE(queue.try_push(round * 4 + i));
+    }
+    EXPECT_EQ(queue.sizeEstimate(), 4u);
+    EXPECT_FALSE(queue.try_push(0));
+    for (int i = 0; i < 4; i++) {
+      EXPECT_TRUE(queue.try_pop(value));
+      EXPECT_EQ(value, round * 4 + i);
+    }
+    EXPECT_TRUE(queue.empty());
+  }
+
+  queue.push(7);
+  queue.pop(value);
+  EXPECT_EQ(value, 7);
+}
+
+TEST(MpmcQueue, DestroysRecordsTest) {
+  auto counted = std::make_shared<int>(0);
+  {
+    MpmcQueue<std::shared_ptr<int>> queue(4);
+    for (int i = 0; i < 3; i++) {
+      queue.push(counted);
+    }
+    std::shared_ptr<int> value;
+    EXPECT_TRUE(queue.try_pop(value));
+    value.reset();
+    EXPECT_EQ(counted.use_count(), 3);
+  }
+  EXPECT_EQ(counted.use_count(), 1);
+}
+
+// Half the threads use the blocking calls and half the try_ ones, and every
+// value must come out exactly once.
+TEST(MpmcQueue, ConcurrentQueueTest) {
+  const size_t numThreads = 4;
+  const size_t perProducer = 1 << 16;
+  MpmcQueue<size_t> queue(64);
+  std::vector<std::atomic<int>> seen(numThreads * perProducer);
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < numThreads; t++) {
+    threads.emplace_back([&, t] {
+      for (size_t i = 0; i < perProducer; i++) {
+        const size_t value = t * perProducer + i;
+        if (t % 2 == 0) {
+          queue.push(value);
+        } else {
+          while (!queue.try_push(value)) {
+            std::this_thread::yield();
+          }
+        }
+      }
+    });
+    threads.emplace_back([&, t] {
+      for (size_t i = 0; i < perProducer; i++) {
+        size_t value;
+        if (t % 2 == 0) {
+          queue.pop(value);
+        } else {
+          while (!queue.try_pop(value)) {
+            std::this_thread::yield();
+          }
+        }
+        seen[value].fetch_add(1, std::memory_order_relaxed);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  for (auto& count : seen) {
+    EXPECT_EQ(count.load(), 1);
+  }
+  EXPECT_TRUE(queue.empty());
+}
+
+int main(int argc, char* argv[]) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+// Dmitry Vyukov's intrusive MPSC queue, of anything that derives from
+// MpscNode. A push takes one atomic exchange and one store, whatever the
+// other producers are doing, so it's wait-free. The consumer takes nodes from
+// the other end without any atomic read-modify-write, except for one
+// exchange when it takes the last node. The queue doesn't own its nodes.
+//
+// A producer stopped between its exchange and its store hides the nodes
+// pushed after it from the consumer until it resumes.
+struct MpscNode {
+  std::atomic<MpscNode*> next{nullptr};
+};
+
+class IntrusiveMpscQueue {
+#ifdef __cpp_lib_hardware_interference_size
+  static constexpr size_t kCacheLineSize =
+      std::hardware_destructive_interference_size;
+#else
+  static constexpr size_t kCacheLineSize = 64;
+#endif
+
+  // Producers swap themselves in at head_, and then link the node they
+  // replaced to them. The consumer takes nodes from tail_. stub_ keeps the
+  // queue from ever being empty, so that neither end needs a special case.
+  alignas(kCacheLineSize) std::atomic<MpscNode*> head_;
+  alignas(kCacheLineSize) MpscNode* tail_;
+  MpscNode stub_;
+
+ public:
+  IntrusiveMpscQueue() : head_(&stub_), tail_(&stub_) {}
+
+  // Avoid copying
+  IntrusiveMpscQueue(const IntrusiveMpscQueue&) = delete;
+  IntrusiveMpscQueue& operator=(const IntrusiveMpscQueue&) = delete;
+
+  void push(MpscNode* node) {
+    node->next.store(nullptr, std::memory_order_relaxed);
+    auto* prev = head_.exchange(node, std::memory_order_acq_rel);
+    prev->next.store(node, std::memory_order_release);
+  }
+
+  // Consumer only. Returns null if the queue is empty, or a producer is
+  // halfway through pushing.
+  MpscNode* pop() {
+    auto* tail = tail_;
+    auto* next = tail->next.load(std::memory_order_acquire);
+    if (tail == &stub_) {
+      if (!next) {
+        return nullptr;
+      }
+      tail_ = tail = next;
+      next = next->next.load(std::memory_order_acquire);
+    }
+    if (next) {
+      tail_ = next;
+      return tail;
+    }
+    if (tail != head_.load(std::memory_order_acquire)) {
+      return nullptr;
+    }
+    // tail is the last node: put the stub behind it, so we can take it.
+    push(&stub_);
+    next = tail->next.load(std::memory_order_acquire);
+    if (next) {
+      tail_ = next;
+      return tail;
+    }
+    return nullptr;
+  }
+};
+
+// Unbounded multi producer single consumer queue of records, on an
+// IntrusiveMpscQueue (as are Strand's tasks, in threadpool/Strand.h). The
+// price of a wait-free push is an allocation per record.
+template <class T>
+class MpscQueue {
+  struct Record : MpscNode {
+    T value;
+
+    template <class... Args>
+    explicit Record(Args&&... recordArgs)
+        : value(std::forward<Args>(recordArgs)...) {}
+  };
+
+  IntrusiveMpscQueue queue_;
+
+  Record* take() { return static_cast<Record*>(queue_.pop()); }
+
+ public:
+  typedef T value_type;
+
+  MpscQueue() = default;
+
+  // Avoid copying
+  MpscQueue(const MpscQueue&) = delete;
+  MpscQueue& operator=(const MpscQueue&) = delete;
+
+  ~MpscQueue() {
+    // No real synchronization needed at destructor time: only one
+    // thread can be doing this.
+    while (auto* record = take()) {
+      delete record;
+    }
+  }
+
+  template <class... Args>
+  void push(Args&&... recordArgs) {
+    queue_.push(new Record(std::forward<Args>(recordArgs)...));
+  }
+
+  // Consumer only. Returns false if the queue is empty (or looks it, see
+  // above).
+  bool try_pop(T& record) {
+    auto* next = take();
+    if (!next) {
+      return false;
+    }
+    record = std::move(next->value);
+    delete next;
+    return true;
+  }
+
+  // Consumer only. Calls fn(record) in place on up to max records, in the
+  // order they were pushed. Returns how many it consumed.
+  template <class F>
+  size_t consume_all(F&& fn, size_t max = SIZE_MAX) {
+    size_t n = 0;
+    for (Record* next; n != max && (next = take()); ++n) {
+      fn(next->value);
+      delete next;
+    }
+    return n;
+  }
+};
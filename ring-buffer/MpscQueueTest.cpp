@@ -0,0 +1,92 @@
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "MpscQueue.h"
+#include "MpscRingBuffer.h"
+
+TEST(MpscRingBuffer, SimpleQueueTest) {
+  MpscRingBuffer<std::string> queue(4);
+  EXPECT_TRUE(queue.empty());
+  for (int round = 0; round < 3; round++) {
+    for (int i = 0; i < 4; i++) {
+      EXPECT_TRUE(queue.try_push(std::to_string(round * 4 + i)));
+    }
+    EXPECT_FALSE(queue.try_push("full"));
+    std::string value;
+    EXPECT_TRUE(queue.try_pop(value));
+    EXPECT_EQ(value, std::to_string(round * 4));
+    std::vector<std::string> rest;
+    EXPECT_EQ(queue.consume_all([&](std::string& s) { rest.push_back(s); }),
+              3u);
+    EXPECT_EQ(rest.back(), std::to_string(round * 4 + 3));
+    EXPECT_TRUE(queue.empty());
+  }
+}
+
+TEST(MpscQueue, SimpleQueueTest) {
+  auto counted = std::make_shared<int>(0);
+  {
+    MpscQueue<std::shared_ptr<int>> queue;
+    std::shared_ptr<int> value;
+    EXPECT_FALSE(queue.try_pop(value));
+    for (int i = 0; i < 5; i++) {
+      queue.push(counted);
+    }
+    EXPECT_TRUE(queue.try_pop(value));
+    EXPECT_EQ(queue.consume_all([](auto&) {}, 2), 2u);
+    value.reset();
+    EXPECT_EQ(counted.use_count(), 3);
+  }
+  // The destructor frees the records that are left.
+  EXPECT_EQ(counted.use_count(), 1);
+}
+
+// Each producer's values must come out in the order it pushed them.
+template <typename QueueType>
+static void CheckConcurrentProducers(QueueType& queue) {
+  const size_t numProducers = 4;
+  const size_t perProducer = 1 << 16;
+  std::vector<std::thread> producers;
+  for (size_t p = 0; p < numProducers; p++) {
+    producers.emplace_back([&, p] {
+      for (size_t i = 0; i < perProducer; i++) {
+        queue.push(p * perProducer + i);
+      }
+    });
+  }
+  std::vector<size_t> next(numProducers, 0);
+  bool ordered = true;
+  for (size_t consumed = 0; consumed < numProducers * perProducer;) {
+    consumed += queue.consume_all([&](size_t value) {
+      const size_t p = value / perProducer;
+      ordered &= value % perProducer == next[p]++;
+    });
+  }
+  for (auto& producer : producers) {
+    producer.join();
+  }
+  EXPECT_TRUE(ordered);
+  EXPECT_EQ(next, std::vector<size_t>(numProducers, perProducer));
+}
+
+TEST(MpscRingBuffer, ConcurrentQueueTest) {
+  MpscRingBuffer<size_t> queue(64);
+  CheckConcurrentProducers(queue);
+  EXPECT_TRUE(queue.empty());
+}
+
+TEST(MpscQueue, ConcurrentQueueTest) {
+  MpscQueue<size_t> queue;
+  CheckConcurrentProducers(queue);
+  size_t value;
+  EXPECT_FALSE(queue.try_pop(value));
+}
+
+int main(int argc, char* argv[]) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
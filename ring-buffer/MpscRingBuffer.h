@@ -0,0 +1,111 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+#include "SequencedSlots.h"
+
+// Lock-free multi producer single consumer queue with a fixed capacity, for
+// many threads feeding one (a log or metrics flusher, say). Producers claim
+// slots like MpmcQueue's do (see SequencedSlots.h), but there is only one
+// consumer, so its index is a plain variable: popping takes no atomic
+// read-modify-write at all, and consume_all drains everything that's ready
+// in one pass.
+template <class T>
+class MpscRingBuffer {
+#ifdef __cpp_lib_hardware_interference_size
+  static constexpr size_t kCacheLineSize =
+      std::hardware_destructive_interference_size;
+#else
+  static constexpr size_t kCacheLineSize = 64;
+#endif
+  using Slots = SequencedSlots<T>;
+  using Slot = typename Slots::Slot;
+  using AtomicIndex = typename Slots::AtomicIndex;
+
+  char pad0_[kCacheLineSize];
+  Slots slots_;
+
+  alignas(kCacheLineSize) AtomicIndex writeIndex_{0};
+  // Only the consumer touches it
+  alignas(kCacheLineSize) size_t readIndex_{0};
+
+  char pad1_[kCacheLineSize - sizeof(size_t)];
+
+  // The slot at the front of the queue, if its record is ready
+  Slot* ready() {
+    auto& slot = slots_[readIndex_];
+    if (slot.sequence.load(std::memory_order_acquire) != readIndex_ + 1) {
+      return nullptr;
+    }
+    return &slot;
+  }
+
+ public:
+  typedef T value_type;
+
+  // Avoid copying
+  MpscRingBuffer(const MpscRingBuffer&) = delete;
+  MpscRingBuffer& operator=(const MpscRingBuffer&) = delete;
+
+  // Every slot is usable, but there must be a power of two of them.
+  explicit MpscRingBuffer(uint32_t size) : slots_(size) {}
+
+  ~MpscRingBuffer() {
+    // No real synchronization needed at destructor time: only one
+    // thread can be doing this.
+    slots_.destroy(readIndex_, writeIndex_.load(std::memory_order_relaxed));
+  }
+
+  // Maximum number of items in the queue.
+  size_t capacity() const { return slots_.size(); }
+
+  // Consumer only. Whether the record at the front of the queue is ready.
+  bool empty() { return !ready(); }
+
+  // Returns false if the queue is full.
+  template <class... Args>
+  bool try_push(Args&&... recordArgs) {
+    auto* slot = slots_.claim(writeIndex_, 0);
+    if (!slot) {
+      return false;
+    }
+    Slots::put(*slot, std::forward<Args>(recordArgs)...);
+    return true;
+  }
+
+  // Claims a slot right away, with fetch_add, then waits for room in it if
+  // the queue is full.
+  template <class... Args>
+  void push(Args&&... recordArgs) {
+    const auto ticket = writeIndex_.fetch_add(1, std::memory_order_relaxed);
+    Slots::put(slots_.wait(ticket, 0), std::forward<Args>(recordArgs)...);
+  }
+
+  // Consumer only. Returns false if the queue is empty (or the producer of
+  // the next record is still writing it).
+  bool try_pop(T& record) {
+    auto* slot = ready();
+    if (!slot) {
+      return false;
+    }
+    slots_.take(*slot, record);
+    ++readIndex_;
+    return true;
+  }
+
+  // Consumer only. Calls fn(record) in place on up to max records, in order,
+  // stopping at the first one that isn't ready. Returns how many it consumed.
+  template <class F>
+  size_t consume_all(F&& fn, size_t max = SIZE_MAX) {
+    size_t n = 0;
+    for (Slot* slot; n != max && (slot = ready()); ++n) {
+      fn(*slot->record());
+      slots_.release(*slot);
+      ++readIndex_;
+    }
+    return n;
+  }
+};
@@ -1,14 +1,25 @@
 
 #pragma once
 
+#include <algorithm>
 #include <atomic>
 #include <cassert>
+#include <chrono>
+#include <cstdint>
 #include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iterator>
 #include <memory>
+#include <optional>
+#include <span>
 #include <stdexcept>
+#include <thread>
 #include <type_traits>
 #include <utility>
 
+#include "../mutex/futex_wrapper.h"
+
 // Lock-free since producer single consumer queue
 template <class T>
 struct RingBuffer {
@@ -28,7 +39,132 @@ struct RingBuffer {
   alignas(kCacheLineSize) AtomicIndex readIndex_;
   alignas(kCacheLineSize) AtomicIndex writeIndex_;
 
-  char pad1_[kCacheLineSize - sizeof(AtomicIndex)];
+  // Set by a side that is about to sleep in push_wait or pop_wait, and
+  // cleared by the other side when it wakes it up. Futex words, so 32 bits.
+  alignas(kCacheLineSize) std::atomic<uint32_t> consumerWaiting_{0};
+  std::atomic<uint32_t> producerWaiting_{0};
+
+  char pad1_[kCacheLineSize - 2 * sizeof(std::atomic<uint32_t>)];
+
+  using Clock = std::chrono::steady_clock;
+  // Attempts a waiting push or pop makes before it goes to sleep
+  static constexpr unsigned kWaitSpins = 256;
+
+  // Wakes up the other side if it's asleep. The fence pairs with the one in
+  // waitUntil: either we see its flag, or it sees what we just published.
+  static void wake(std::atomic<uint32_t>& waiting) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiting.load(std::memory_order_relaxed) != 0 &&
+        waiting.exchange(0, std::memory_order_relaxed) != 0) {
+      futex_wake(reinterpret_cast<uint32_t*>(&waiting), true);
+    }
+  }
+
+  template <class Rep, class Period>
+  static Clock::time_point deadline(
+      const std::chrono::duration<Rep, Period>& timeout) {
+    return Clock::now() + std::chrono::ceil<Clock::duration>(timeout);
+  }
+
+  // Retries attempt() until it succeeds or the deadline passes, spinning
+  // for a while and then sleeping until the other side wakes us.
+  template <class F>
+  static bool waitUntil(std::atomic<uint32_t>& waiting, F&& attempt,
+                        std::optional<Clock::time_point> deadline) {
+    for (unsigned spins = 0; spins != kWaitSpins; ++spins) {
+      if (attempt()) {
+        return true;
+      }
+#if defined(__x86_64__) || defined(__i386__)
+      __builtin_ia32_pause();
+#else
+      std::this_thread::yield();
+#endif
+    }
+    for (;;) {
+      waiting.store(1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (attempt()) {
+        waiting.store(0, std::memory_order_relaxed);
+        return true;
+      }
+      timespec left{};
+      if (deadline) {
+        const auto now = Clock::now();
+        if (now >= *deadline) {
+          waiting.store(0, std::memory_order_relaxed);
+          return false;
+        }
+        const auto ns = std::chrono::nanoseconds(*deadline - now).count();
+        left.tv_sec = ns / 1000000000;
+        left.tv_nsec = ns % 1000000000;
+      }
+      futex_wait(reinterpret_cast<uint32_t*>(&waiting), 1,
+                 deadline ? &left : nullptr);
+    }
+  }
+
+  // Slots the producer may fill. One always stays empty, to tell a full
+  // queue from an empty one.
+  size_t freeSlots(size_t currentWrite, size_t currentRead) const {
+    return currentRead > currentWrite ? currentRead - currentWrite - 1
+                                      : size_ - currentWrite + currentRead - 1;
+  }
+
+  // Records the consumer may take
+  size_t usedSlots(size_t currentRead, size_t currentWrite) const {
+    return currentWrite >= currentRead ? currentWrite - currentRead
+                                       : size_ - currentRead + currentWrite;
+  }
+
+  size_t advance(size_t index, size_t n) const {
+    index += n;
+    return index >= size_ ? index - size_ : index;
+  }
+
+  // Whether copying between It and the slots can be a plain memcpy
+  template <class It>
+  static constexpr bool bulkCopy() {
+    if constexpr (std::contiguous_iterator<It>) {
+      return std::is_trivially_copyable_v<T> &&
+             std::is_same_v<std::iter_value_t<It>, T>;
+    } else {
+      return false;
+    }
+  }
+
+  // Constructs n records from first, starting at slot 'at', without wrapping
+  template <class It>
+  It copyIn(It first, size_t at, size_t n) {
+    if constexpr (bulkCopy<It>()) {
+      if (n != 0) {
+        std::memcpy(&records_[at], std::to_address(first), n * sizeof(T));
+      }
+      return first + n;
+    } else {
+      for (size_t i = 0; i != n; ++i, ++first) {
+        new (&records_[at + i]) T(*first);
+      }
+      return first;
+    }
+  }
+
+  // Moves n records out to out, starting at slot 'at', without wrapping
+  template <class It>
+  It moveOut(size_t at, size_t n, It out) {
+    if constexpr (bulkCopy<It>()) {
+      if (n != 0) {
+        std::memcpy(std::to_address(out), &records_[at], n * sizeof(T));
+      }
+      return out + n;
+    } else {
+      for (size_t i = 0; i != n; ++i, ++out) {
+        *out = std::move(records_[at + i]);
+        records_[at + i].~T();
+      }
+      return out;
+    }
+  }
 
  public:
   typedef T value_type;
@@ -133,10 +269,101 @@ struct RingBuffer {
       nextRecord = 0;
     }
     record = std::move(records_[currentRead]);
+    records_[currentRead].~T();
     readIndex_.store(nextRecord, std::memory_order_release);
     return true;
   }
 
+  // Pushes as many of the count records from first as fit, and returns how
+  // many it pushed. The whole batch is published with a single index store,
+  // and trivially copyable records are copied in at most two memcpys.
+  template <class It>
+  size_t push_n(It first, size_t count) {
+    const size_t currentWrite = writeIndex_.load(std::memory_order_relaxed);
+    const size_t currentRead = readIndex_.load(std::memory_order_acquire);
+    const size_t n = std::min(count, freeSlots(currentWrite, currentRead));
+    const size_t untilEnd = std::min<size_t>(n, size_ - currentWrite);
+    first = copyIn(first, currentWrite, untilEnd);
+    copyIn(first, 0, n - untilEnd);
+    writeIndex_.store(advance(currentWrite, n), std::memory_order_release);
+    return n;
+  }
+
+  // Moves up to max records out to out, and returns how many it popped. Like
+  // push_n, with a single index store.
+  template <class It>
+  size_t pop_n(It out, size_t max) {
+    const size_t currentRead = readIndex_.load(std::memory_order_relaxed);
+    const size_t currentWrite = writeIndex_.load(std::memory_order_acquire);
+    const size_t n = std::min(max, usedSlots(currentRead, currentWrite));
+    const size_t untilEnd = std::min<size_t>(n, size_ - currentRead);
+    out = moveOut(currentRead, untilEnd, out);
+    moveOut(0, n - untilEnd, out);
+    readIndex_.store(advance(currentRead, n), std::memory_order_release);
+    return n;
+  }
+
+  // Calls fn(record) on every record in the queue, in place, then removes
+  // them all with a single index store. Returns how many there were.
+  template <class F>
+  size_t consume_all(F&& fn) {
+    const size_t currentRead = readIndex_.load(std::memory_order_relaxed);
+    const size_t currentWrite = writeIndex_.load(std::memory_order_acquire);
+    size_t n = 0;
+    for (size_t i = currentRead; i != currentWrite; ++n) {
+      fn(records_[i]);
+      records_[i].~T();
+      if (++i == size_) {
+        i = 0;
+      }
+    }
+    readIndex_.store(currentWrite, std::memory_order_release);
+    return n;
+  }
+
+  // Blocking variants of push and pop, for queues that are often empty (or
+  // full): they spin for a bit, and then sleep on a futex until the other
+  // side wakes them up. Each side only makes a syscall when the other one is
+  // actually asleep. Only push_wait wakes up pop_wait and vice versa, so
+  // that push and pop don't pay for a fence: use both or neither.
+  template <class... Args>
+  void push_wait(Args&&... recordArgs) {
+    // push only uses the arguments when it succeeds, so they can be
+    // forwarded to every attempt.
+    auto attempt = [&] { return push(std::forward<Args>(recordArgs)...); };
+    waitUntil(producerWaiting_, attempt, std::nullopt);
+    wake(consumerWaiting_);
+  }
+
+  // Returns false if there was no room before the timeout expired.
+  template <class Rep, class Period, class... Args>
+  bool push_wait_for(const std::chrono::duration<Rep, Period>& timeout,
+                     Args&&... recordArgs) {
+    auto attempt = [&] { return push(std::forward<Args>(recordArgs)...); };
+    if (!waitUntil(producerWaiting_, attempt, deadline(timeout))) {
+      return false;
+    }
+    wake(consumerWaiting_);
+    return true;
+  }
+
+  void pop_wait(T& record) {
+    waitUntil(consumerWaiting_, [&] { return pop(record); }, std::nullopt);
+    wake(producerWaiting_);
+  }
+
+  // Returns false if the queue stayed empty until the timeout expired.
+  template <class Rep, class Period>
+  bool pop_wait_for(T& record,
+                    const std::chrono::duration<Rep, Period>& timeout) {
+    if (!waitUntil(consumerWaiting_, [&] { return pop(record); },
+                   deadline(timeout))) {
+      return false;
+    }
+    wake(producerWaiting_);
+    return true;
+  }
+
   // Returns a pointer to the value at the front of the queue (for use in-place)
   T* front() {
     auto const currentRead = readIndex_.load(std::memory_order_relaxed);
@@ -146,4 +373,53 @@ struct RingBuffer {
     }
     return &records_[currentRead];
   }
+
+  // Zero-copy producer side: returns up to max free slots, contiguous (so
+  // fewer than are free if they wrap around the end), for the producer to
+  // construct records in with std::construct_at or placement new. The slots
+  // are raw memory until then. commit(n) then publishes the first n of them.
+  std::span<T> reserve(size_t max) {
+    const size_t currentWrite = writeIndex_.load(std::memory_order_relaxed);
+    const size_t currentRead = readIndex_.load(std::memory_order_acquire);
+    const size_t n = std::min({max, freeSlots(currentWrite, currentRead),
+                               size_ - currentWrite});
+    return {&records_[currentWrite], n};
+  }
+
+  // A single free slot, or nullptr if the queue is full
+  T* reserve() {
+    auto slots = reserve(1);
+    return slots.empty() ? nullptr : slots.data();
+  }
+
+  // Publishes the next n slots, which must have been reserved and have had
+  // records constructed in them.
+  void commit(size_t n = 1) {
+    const size_t currentWrite = writeIndex_.load(std::memory_order_relaxed);
+    writeIndex_.store(advance(currentWrite, n), std::memory_order_release);
+  }
+
+  // Zero-copy consumer side: returns up to max records from the front of the
+  // queue, contiguous (so fewer than there are if they wrap around the end),
+  // to use in place. release(n) then removes the first n of them.
+  std::span<T> peek_span(size_t max = SIZE_MAX) {
+    const size_t currentRead = readIndex_.load(std::memory_order_relaxed);
+    const size_t currentWrite = writeIndex_.load(std::memory_order_acquire);
+    const size_t n = std::min({max, usedSlots(currentRead, currentWrite),
+                               size_ - currentRead});
+    return {&records_[currentRead], n};
+  }
+
+  // Destroys the n records at the front of the queue, which must be there
+  // (seen through front() or peek_span()), and frees their slots.
+  void release(size_t n = 1) {
+    const size_t currentRead = readIndex_.load(std::memory_order_relaxed);
+    if constexpr (!std::is_trivially_destructible_v<T>) {
+      for (size_t i = 0, index = currentRead; i != n; ++i) {
+        records_[index].~T();
+        index = advance(index, 1);
+      }
+    }
+    readIndex_.store(advance(currentRead, n), std::memory_order_release);
+  }
 };
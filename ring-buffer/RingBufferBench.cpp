@@ -1,8 +1,22 @@
+#include <algorithm>
 #include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <numeric>
 #include <thread>
+#include <type_traits>
+#include <vector>
 
 #include <benchmark/benchmark.h>
 
+#include "BipBuffer.h"
+#include "FixedRingBuffer.h"
+#include "MpmcQueue.h"
+#include "MpscQueue.h"
+#include "MpscRingBuffer.h"
 #include "RingBuffer.h"
 #include "SingleThreadedRingBuffer.h"
 
@@ -46,6 +60,344 @@ static void BM_RingBuffer(benchmark::State& state) {
   }
 }
 
+// Same as BM_RingBuffer, but both sides sleep instead of yielding when they
+// have to wait.
+static void BM_RingBufferWait(benchmark::State& state) {
+  for (auto _ : state) {
+    state.PauseTiming();
+    const size_t iter = state.range(0);
+    RingBuffer<size_t> ring(iter / 1000 + 1);
+    long sum = 0;
+
+    state.ResumeTiming();
+
+    std::thread producer([&] {
+      for (size_t i = 0; i < iter; ++i) {
+        ring.push_wait(i);
+      }
+    });
+
+    for (size_t i = 0; i < iter; ++i) {
+      size_t value;
+      ring.pop_wait(value);
+      sum += value;
+    }
+
+    producer.join();
+    benchmark::DoNotOptimize(sum);
+    benchmark::ClobberMemory();
+  }
+}
+
+// Same as BM_RingBuffer, with the batch APIs: the producer pushes kBatch
+// values at a time and the consumer drains whatever is there.
+static void BM_RingBufferBatch(benchmark::State& state) {
+  constexpr size_t kBatch = 64;
+  for (auto _ : state) {
+    state.PauseTiming();
+    const size_t iter = state.range(0);
+    RingBuffer<size_t> ring(iter / 1000 + 1);
+    std::vector<size_t> values(kBatch);
+    std::atomic<bool> flag(false);
+    long sum = 0;
+
+    state.ResumeTiming();
+
+    std::thread producer([&] {
+      while (!flag) {
+        std::this_thread::yield();
+      }
+
+      size_t i = 0;
+      while (i < iter) {
+        const size_t n = std::min(kBatch, iter - i);
+        std::iota(values.begin(), values.begin() + n, i);
+        for (size_t pushed = 0; pushed != n;) {
+          pushed += ring.push_n(values.begin() + pushed, n - pushed);
+        }
+        i += n;
+      }
+    });
+
+    flag = true;
+    for (size_t i = 0; i < iter;) {
+      const size_t n = ring.consume_all([&](size_t value) { sum += value; });
+      if (n == 0) {
+        std::this_thread::yield();
+      }
+      i += n;
+    }
+
+    producer.join();
+    benchmark::DoNotOptimize(sum);
+    benchmark::ClobberMemory();
+  }
+}
+
+// Room for this many values, to compare FixedRingBuffer with RingBuffer
+constexpr size_t kFixedCapacity = 1024;
+
+template <typename BufferType>
+static std::unique_ptr<BufferType> MakeFixedCapacityRing() {
+  if constexpr (std::is_default_constructible_v<BufferType>) {
+    return std::make_unique<BufferType>();
+  } else {
+    return std::make_unique<BufferType>(kFixedCapacity + 1);
+  }
+}
+
+template <typename BufferType>
+static void BM_FixedCapacity(benchmark::State& state) {
+  for (auto _ : state) {
+    state.PauseTiming();
+    const size_t iter = state.range(0);
+    auto ring = MakeFixedCapacityRing<BufferType>();
+    std::atomic<bool> flag(false);
+    long sum = 0;
+
+    state.ResumeTiming();
+
+    std::thread producer([&] {
+      while (!flag) {
+        std::this_thread::yield();
+      }
+
+      size_t i = 0;
+      while (i < iter) {
+        if (ring->push(i)) {
+          i++;
+        } else {
+          std::this_thread::yield();
+        }
+      }
+    });
+
+    flag = true;
+    for (size_t i = 0; i < iter; ++i) {
+      size_t value;
+      while (!ring->pop(value)) {
+        std::this_thread::yield();
+      }
+      sum += value;
+    }
+
+    producer.join();
+    benchmark::DoNotOptimize(sum);
+    benchmark::ClobberMemory();
+  }
+}
+
+// A mutex around a deque, the usual alternative to MpmcQueue
+template <class T>
+class LockedQueue {
+  std::mutex mutex_;
+  std::deque<T> records_;
+  const size_t capacity_;
+
+ public:
+  explicit LockedQueue(uint32_t size) : capacity_(size) {}
+
+  bool try_push(T record) {
+    std::lock_guard<std::mutex> lock{mutex_};
+    if (records_.size() == capacity_) {
+      return false;
+    }
+    records_.push_back(std::move(record));
+    return true;
+  }
+
+  bool try_pop(T& record) {
+    std::lock_guard<std::mutex> lock{mutex_};
+    if (records_.empty()) {
+      return false;
+    }
+    record = std::move(records_.front());
+    records_.pop_front();
+    return true;
+  }
+};
+
+// Moves a fixed number of values from range(0) producers to range(1)
+// consumers.
+template <typename QueueType>
+static void BM_MultiProducerMultiConsumer(benchmark::State& state) {
+  constexpr size_t kValues = 1 << 20;
+  const size_t producers = state.range(0);
+  const size_t consumers = state.range(1);
+  for (auto _ : state) {
+    QueueType queue(1024);
+    std::atomic<bool> flag(false);
+    std::atomic<long> sum(0);
+    std::vector<std::thread> threads;
+    for (size_t p = 0; p < producers; ++p) {
+      threads.emplace_back([&, p] {
+        while (!flag) {
+          std::this_thread::yield();
+        }
+        for (size_t i = p; i < kValues; i += producers) {
+          while (!queue.try_push(i)) {
+            std::this_thread::yield();
+          }
+        }
+      });
+    }
+    for (size_t c = 0; c < consumers; ++c) {
+      threads.emplace_back([&, c] {
+        while (!flag) {
+          std::this_thread::yield();
+        }
+        long local = 0;
+        for (size_t i = c; i < kValues; i += consumers) {
+          size_t value;
+          while (!queue.try_pop(value)) {
+            std::this_thread::yield();
+          }
+          local += value;
+        }
+        sum += local;
+      });
+    }
+    flag = true;
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    benchmark::DoNotOptimize(sum.load());
+  }
+  state.SetItemsProcessed(state.iterations() * kValues);
+}
+
+// Pushes value, waiting for room if the queue is bounded
+template <typename QueueType>
+static void PushOne(QueueType& queue, size_t value) {
+  if constexpr (requires { queue.try_push(value); }) {
+    while (!queue.try_push(value)) {
+      std::this_thread::yield();
+    }
+  } else {
+    queue.push(value);
+  }
+}
+
+// Takes whatever is in the queue, a batch at a time if it can
+template <typename QueueType, typename F>
+static size_t Drain(QueueType& queue, F&& fn) {
+  if constexpr (requires { queue.consume_all(fn); }) {
+    return queue.consume_all(fn);
+  } else {
+    size_t n = 0;
+    for (size_t value; queue.try_pop(value); ++n) {
+      fn(value);
+    }
+    return n;
+  }
+}
+
+template <typename QueueType>
+static std::unique_ptr<QueueType> MakeQueue() {
+  if constexpr (std::is_default_constructible_v<QueueType>) {
+    return std::make_unique<QueueType>();
+  } else {
+    return std::make_unique<QueueType>(1024);
+  }
+}
+
+// Moves a fixed number of values from range(0) producers to one consumer.
+template <typename QueueType>
+static void BM_ManyProducersOneConsumer(benchmark::State& state) {
+  constexpr size_t kValues = 1 << 20;
+  const size_t producers = state.range(0);
+  for (auto _ : state) {
+    auto queue = MakeQueue<QueueType>();
+    std::atomic<bool> flag(false);
+    long sum = 0;
+    std::vector<std::thread> threads;
+    for (size_t p = 0; p < producers; ++p) {
+      threads.emplace_back([&, p] {
+        while (!flag) {
+          std::this_thread::yield();
+        }
+        for (size_t i = p; i < kValues; i += producers) {
+          PushOne(*queue, i);
+        }
+      });
+    }
+    flag = true;
+    for (size_t consumed = 0; consumed < kValues;) {
+      const size_t n = Drain(*queue, [&](size_t value) { sum += value; });
+      if (n == 0) {
+        std::this_thread::yield();
+      }
+      consumed += n;
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(state.iterations() * kValues);
+}
+
+// Lengths of the messages BM_MixedSizeMessages sends, from 16 bytes to 4KB
+static size_t MessageLength(size_t i) { return 16 + i * 7919 % 4081; }
+
+// Messages of mixed sizes, either as vectors in a RingBuffer (an allocation
+// each) or in place in a BipBuffer.
+template <bool UseBipBuffer>
+static void BM_MixedSizeMessages(benchmark::State& state) {
+  constexpr size_t kMessages = 1 << 16;
+  for (auto _ : state) {
+    state.PauseTiming();
+    // The same 1MB either way
+    constexpr size_t kBytes = 1 << 20;
+    BipBuffer bip(kBytes);
+    RingBuffer<std::vector<std::byte>> ring(kBytes / 2048);
+    long sum = 0;
+
+    state.ResumeTiming();
+
+    std::thread producer([&] {
+      for (size_t i = 0; i < kMessages;) {
+        const size_t length = MessageLength(i);
+        if constexpr (UseBipBuffer) {
+          if (auto* bytes = bip.reserve(length)) {
+            std::memset(bytes, static_cast<int>(i), length);
+            bip.commit(length);
+            ++i;
+            continue;
+          }
+        } else {
+          if (ring.push(length, static_cast<std::byte>(i))) {
+            ++i;
+            continue;
+          }
+        }
+        std::this_thread::yield();
+      }
+    });
+
+    for (size_t i = 0; i < kMessages;) {
+      size_t n;
+      if constexpr (UseBipBuffer) {
+        n = bip.consume_all([&](std::span<const std::byte> message) {
+          sum += static_cast<long>(message.back());
+        });
+      } else {
+        n = ring.consume_all([&](const std::vector<std::byte>& message) {
+          sum += static_cast<long>(message.back());
+        });
+      }
+      if (n == 0) {
+        std::this_thread::yield();
+      }
+      i += n;
+    }
+
+    producer.join();
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(state.iterations() * kMessages);
+}
+
 BENCHMARK_TEMPLATE(BM_RingBuffer, SingleThreadedRingBuffer<size_t>)
     ->Range(1 << 16, 1 << 24)
     ->RangeMultiplier(2)
@@ -56,4 +408,56 @@ BENCHMARK_TEMPLATE(BM_RingBuffer, RingBuffer<size_t>)
     ->RangeMultiplier(2)
     ->UseRealTime();
 
+BENCHMARK(BM_RingBufferWait)
+    ->Range(1 << 16, 1 << 24)
+    ->RangeMultiplier(2)
+    ->UseRealTime();
+
+BENCHMARK(BM_RingBufferBatch)
+    ->Range(1 << 16, 1 << 24)
+    ->RangeMultiplier(2)
+    ->UseRealTime();
+
+BENCHMARK_TEMPLATE(BM_FixedCapacity, RingBuffer<size_t>)
+    ->Range(1 << 16, 1 << 24)
+    ->RangeMultiplier(2)
+    ->UseRealTime();
+
+BENCHMARK_TEMPLATE(BM_FixedCapacity, FixedRingBuffer<size_t, kFixedCapacity>)
+    ->Range(1 << 16, 1 << 24)
+    ->RangeMultiplier(2)
+    ->UseRealTime();
+
+BENCHMARK_TEMPLATE(BM_MultiProducerMultiConsumer, LockedQueue<size_t>)
+    ->ArgsProduct({{1, 2, 4, 8}, {1, 2, 4, 8}})
+    ->UseRealTime();
+
+BENCHMARK_TEMPLATE(BM_MultiProducerMultiConsumer, MpmcQueue<size_t>)
+    ->ArgsProduct({{1, 2, 4, 8}, {1, 2, 4, 8}})
+    ->UseRealTime();
+
+BENCHMARK_TEMPLATE(BM_ManyProducersOneConsumer, LockedQueue<size_t>)
+    ->RangeMultiplier(2)
+    ->Range(1, 32)
+    ->UseRealTime();
+
+BENCHMARK_TEMPLATE(BM_ManyProducersOneConsumer, MpmcQueue<size_t>)
+    ->RangeMultiplier(2)
+    ->Range(1, 32)
+    ->UseRealTime();
+
+BENCHMARK_TEMPLATE(BM_ManyProducersOneConsumer, MpscRingBuffer<size_t>)
+    ->RangeMultiplier(2)
+    ->Range(1, 32)
+    ->UseRealTime();
+
+BENCHMARK_TEMPLATE(BM_ManyProducersOneConsumer, MpscQueue<size_t>)
+    ->RangeMultiplier(2)
+    ->Range(1, 32)
+    ->UseRealTime();
+
+BENCHMARK_TEMPLATE(BM_MixedSizeMessages, false)->UseRealTime();
+
+BENCHMARK_TEMPLATE(BM_MixedSizeMessages, true)->UseRealTime();
+
 BENCHMARK_MAIN();
@@ -1,5 +1,12 @@
+#include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <iterator>
+#include <memory>
+#include <numeric>
+#include <string>
 #include <thread>
+#include <vector>
 
 #include "gtest/gtest.h"
 
@@ -75,6 +82,159 @@ TEST(RingBuffer, ReadRingBufferTest) {
   }
 }
 
+TEST(RingBuffer, BatchRingBufferTest) {
+  RingBuffer<int> ring(11);
+  std::vector<int> in(25);
+  std::iota(in.begin(), in.end(), 0);
+  // Only 10 fit
+  EXPECT_EQ(ring.push_n(in.begin(), in.size()), 10u);
+  EXPECT_TRUE(ring.full());
+
+  std::vector<int> out(4);
+  EXPECT_EQ(ring.pop_n(out.begin(), out.size()), 4u);
+  EXPECT_EQ(out, (std::vector<int>{0, 1, 2, 3}));
+  // These wrap around the end of the slots.
+  EXPECT_EQ(ring.push_n(in.begin() + 10, 15), 4u);
+
+  std::vector<int> rest;
+  EXPECT_EQ(ring.pop_n(std::back_inserter(rest), 100), 10u);
+  EXPECT_EQ(rest, std::vector<int>(in.begin() + 4, in.begin() + 14));
+  EXPECT_TRUE(ring.empty());
+  EXPECT_EQ(ring.pop_n(out.begin(), out.size()), 0u);
+}
+
+TEST(RingBuffer, ConsumeAllRingBufferTest) {
+  RingBuffer<std::string> ring(8);
+  const std::vector<std::string> words = {"a", "bb", "ccc", "dddd", "eeeee"};
+  for (int round = 0; round < 3; ++round) {
+    EXPECT_EQ(ring.push_n(words.begin(), words.size()), words.size());
+    std::vector<std::string> seen;
+    EXPECT_EQ(ring.consume_all([&](std::string& s) { seen.push_back(s); }),
+              words.size());
+    EXPECT_EQ(seen, words);
+    EXPECT_TRUE(ring.empty());
+  }
+}
+
+TEST(RingBuffer, ConcurrentBatchRingBufferTest) {
+  const size_t numItems = 1 << 20;
+  RingBuffer<size_t> ring(1000);
+  std::thread producer([&] {
+    std::vector<size_t> batch(64);
+    for (size_t i = 0; i < numItems;) {
+      const size_t n = std::min(batch.size(), numItems - i);
+      std::iota(batch.begin(), batch.begin() + n, i);
+      i += ring.push_n(batch.begin(), n);
+    }
+  });
+  size_t expected = 0;
+  bool ordered = true;
+  while (expected < numItems) {
+    ring.consume_all([&](size_t value) { ordered &= value == expected++; });
+  }
+  producer.join();
+  EXPECT_TRUE(ordered);
+  EXPECT_TRUE(ring.empty());
+}
+
+// Big enough that copying it would hurt
+struct Descriptor {
+  size_t id;
+  char payload[248];
+};
+
+TEST(RingBuffer, ReserveCommitRingBufferTest) {
+  RingBuffer<Descriptor> ring(8);
+  size_t next = 0;
+  size_t expected = 0;
+  for (int round = 0; round < 10; ++round) {
+    // Build some in place, one at a time and in a batch.
+    Descriptor* slot = ring.reserve();
+    ASSERT_NE(slot, nullptr);
+    std::construct_at(slot, Descriptor{next++, {}});
+    ring.commit();
+    auto slots = ring.reserve(3);
+    EXPECT_FALSE(slots.empty());
+    for (auto& d : slots) {
+      std::construct_at(&d, Descriptor{next++, {}});
+    }
+    ring.commit(slots.size());
+
+    // Spans stop at the end of the slots, so drain in a loop.
+    for (auto records = ring.peek_span(); !records.empty();
+         records = ring.peek_span()) {
+      for (const auto& d : records) {
+        EXPECT_EQ(d.id, expected++);
+      }
+      ring.release(records.size());
+    }
+    EXPECT_TRUE(ring.empty());
+  }
+  EXPECT_EQ(expected, next);
+}
+
+TEST(RingBuffer, ReleaseDestroysRingBufferTest) {
+  auto counted = std::make_shared<int>(0);
+  RingBuffer<std::shared_ptr<int>> ring(4);
+  for (int i = 0; i < 3; ++i) {
+    std::construct_at(ring.reserve(), counted);
+    ring.commit();
+    EXPECT_EQ(ring.reserve(5).size(), 2u - i);
+  }
+  EXPECT_EQ(ring.reserve(), nullptr);
+  EXPECT_EQ(counted.use_count(), 4);
+  EXPECT_EQ(ring.peek_span(2).size(), 2u);
+  ring.release(2);
+  EXPECT_EQ(counted.use_count(), 2);
+  EXPECT_EQ(*ring.front(), counted);
+  ring.release();
+  EXPECT_EQ(counted.use_count(), 1);
+  EXPECT_TRUE(ring.empty());
+}
+
+TEST(RingBuffer, WaitTimesOutRingBufferTest) {
+  using namespace std::chrono_literals;
+  RingBuffer<int> ring(2);
+  int value;
+  const auto start = std::chrono::steady_clock::now();
+  EXPECT_FALSE(ring.pop_wait_for(value, 20ms));
+  EXPECT_GE(std::chrono::steady_clock::now() - start, 20ms);
+
+  EXPECT_TRUE(ring.push_wait_for(20ms, 1));
+  EXPECT_FALSE(ring.push_wait_for(20ms, 2));
+  EXPECT_TRUE(ring.pop_wait_for(value, 20ms));
+  EXPECT_EQ(value, 1);
+}
+
+// The consumer runs out of values and sleeps between each burst, and then
+// the producer fills the queue up and sleeps, so both sides have to wake the
+// other up.
+TEST(RingBuffer, WaitWakesUpRingBufferTest) {
+  const int numBursts = 20;
+  const int burst = 50;
+  RingBuffer<std::string> ring(8);
+  std::thread producer([&] {
+    for (int b = 0; b < numBursts; ++b) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      for (int i = 0; i < burst; ++i) {
+        ring.push_wait(std::to_string(b * burst + i));
+      }
+    }
+  });
+  bool ordered = true;
+  for (int i = 0; i < numBursts * burst; ++i) {
+    std::string value;
+    ring.pop_wait(value);
+    ordered &= value == std::to_string(i);
+    if (i % burst == burst / 2) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+  producer.join();
+  EXPECT_TRUE(ordered);
+  EXPECT_TRUE(ring.empty());
+}
+
 int main(int argc, char* argv[]) {
   testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+// The slots of MpmcQueue and MpscRingBuffer, after Dmitry Vyukov's bounded
+// MPMC queue: a power-of-two array of records, each with a sequence number
+// that says whose turn it is. The producer of ticket t may fill slot t once
+// its sequence is t, and the consumer of ticket t may empty it once it's
+// t + 1. Emptying it makes it t + size(), for the producer a lap later.
+// Tickets come from a counter at each end, which the queues own.
+template <class T>
+class SequencedSlots {
+  // Spins before a waiting push or pop starts yielding
+  static constexpr unsigned kSpins = 128;
+
+ public:
+  using AtomicIndex = std::atomic<size_t>;
+
+  struct Slot {
+    AtomicIndex sequence;
+    alignas(T) std::byte data[sizeof(T)];
+
+    T* record() { return std::launder(reinterpret_cast<T*>(data)); }
+  };
+
+  // Avoid copying
+  SequencedSlots(const SequencedSlots&) = delete;
+  SequencedSlots& operator=(const SequencedSlots&) = delete;
+
+  explicit SequencedSlots(uint32_t size)
+      : mask_(size - 1), slots_(new Slot[size]) {
+    assert(size >= 2 && std::has_single_bit(size));
+    for (size_t i = 0; i != size; ++i) {
+      slots_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  size_t size() const { return mask_ + 1; }
+
+  Slot& operator[](size_t ticket) { return slots_[ticket & mask_]; }
+
+  // Destroys the records of tickets [first, last), which must all be there.
+  // Not thread-safe: for the queues' destructors.
+  void destroy(size_t first, size_t last) {
+    if (!std::is_trivially_destructible<T>::value) {
+      for (; first != last; ++first) {
+        (*this)[first].record()->~T();
+      }
+    }
+  }
+
+  // Claims the next ticket from index if its slot's sequence is ticket +
+  // offset (0 for producers, 1 for consumers), or returns null if the slot
+  // isn't ready.
+  Slot* claim(AtomicIndex& index, size_t offset) {
+    auto ticket = index.load(std::memory_order_relaxed);
+    for (;;) {
+      auto& slot = (*this)[ticket];
+      const auto sequence = slot.sequence.load(std::memory_order_acquire);
+      const auto diff = static_cast<intptr_t>(sequence - (ticket + offset));
+      if (diff == 0) {
+        if (index.compare_exchange_weak(ticket, ticket + 1,
+                                        std::memory_order_relaxed)) {
+          return &slot;
+        }
+      } else if (diff < 0) {
+        // The slot still holds the record from a lap ago (or hasn't been
+        // filled yet, for a consumer).
+        return nullptr;
+      } else {
+        // Someone took this ticket already.
+        ticket = index.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // The slot of a ticket taken with fetch_add, once its sequence is ticket
+  // + offset. Spins, then yields, but never sleeps.
+  Slot& wait(size_t ticket, size_t offset) {
+    auto& slot = (*this)[ticket];
+    for (unsigned spins = 0;
+         slot.sequence.load(std::memory_order_acquire) != ticket + offset;) {
+      if (spins < kSpins) {
+        ++spins;
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+      } else {
+        std::this_thread::yield();
+      }
+    }
+    return slot;
+  }
+
+  // Fills a slot claimed by a producer, and hands it to the consumers.
+  template <class... Args>
+  static void put(Slot& slot, Args&&... recordArgs) {
+    const auto ticket = slot.sequence.load(std::memory_order_relaxed);
+    new (slot.data) T(std::forward<Args>(recordArgs)...);
+    slot.sequence.store(ticket + 1, std::memory_order_release);
+  }
+
+  // Destroys the record of a slot claimed by a consumer, and hands the slot
+  // back to the producers.
+  void release(Slot& slot) {
+    const auto ticket = slot.sequence.load(std::memory_order_relaxed) - 1;
+    slot.record()->~T();
+    slot.sequence.store(ticket + size(), std::memory_order_release);
+  }
+
+  void take(Slot& slot, T& record) {
+    record = std::move(*slot.record());
+    release(slot);
+  }
+
+ private:
+  const size_t mask_;
+  const std::unique_ptr<Slot[]> slots_;
+};
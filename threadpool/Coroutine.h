@@ -0,0 +1,187 @@
+#pragma once
+
+#include <coroutine>
+#include <exception>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+#include "ThreadPool.h"
+
+// A lazy coroutine that produces a T. It starts when it's awaited, and when
+// it finishes it resumes whoever awaited it right away, on the same thread,
+// through symmetric transfer, so a chain of awaits doesn't grow the stack and
+// doesn't go through the pool. To hop onto the pool, co_await
+// pool.schedule():
+//
+//   CoTask<int> handle(ThreadPool& pool, Request request) {
+//     co_await pool.schedule();  // From here on we run on a worker
+//     auto data = co_await load(pool, request);
+//     co_return process(data);
+//   }
+//
+//   auto response = start(pool, handle(pool, request)).get();
+//
+// (It's not called Task to keep it apart from the callables the pool runs.)
+template <typename T = void>
+class CoTask;
+
+namespace detail {
+
+class CoTaskPromiseBase {
+  std::coroutine_handle<> continuation_{std::noop_coroutine()};
+
+  struct FinalAwaiter {
+    bool await_ready() const noexcept { return false; }
+    template <typename P>
+    std::coroutine_handle<> await_suspend(
+        std::coroutine_handle<P> h) noexcept {
+      return h.promise().continuation_;
+    }
+    void await_resume() const noexcept {}
+  };
+
+ public:
+  std::suspend_always initial_suspend() const noexcept { return {}; }
+  FinalAwaiter final_suspend() const noexcept { return {}; }
+
+  void set_continuation(std::coroutine_handle<> h) { continuation_ = h; }
+};
+
+template <typename T>
+class CoTaskPromise : public CoTaskPromiseBase {
+  std::variant<std::monostate, T, std::exception_ptr> result_;
+
+ public:
+  CoTask<T> get_return_object();
+
+  template <typename U>
+  void return_value(U&& value) {
+    result_.template emplace<1>(std::forward<U>(value));
+  }
+
+  void unhandled_exception() {
+    result_.template emplace<2>(std::current_exception());
+  }
+
+  T result() {
+    if (result_.index() == 2) {
+      std::rethrow_exception(std::get<2>(result_));
+    }
+    return std::move(std::get<1>(result_));
+  }
+};
+
+template <>
+class CoTaskPromise<void> : public CoTaskPromiseBase {
+  std::exception_ptr error_;
+
+ public:
+  CoTask<void> get_return_object();
+
+  void return_void() {}
+
+  void unhandled_exception() { error_ = std::current_exception(); }
+
+  void result() {
+    if (error_) {
+      std::rethrow_exception(error_);
+    }
+  }
+};
+
+}  // namespace detail
+
+template <typename T>
+class CoTask {
+ public:
+  using promise_type = detail::CoTaskPromise<T>;
+
+ private:
+  std::coroutine_handle<promise_type> handle_;
+
+  friend promise_type;
+  explicit CoTask(std::coroutine_handle<promise_type> h) : handle_(h) {}
+
+  struct Awaiter {
+    std::coroutine_handle<promise_type> handle;
+
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> h) noexcept {
+      handle.promise().set_continuation(h);
+      return handle;
+    }
+    T await_resume() { return handle.promise().result(); }
+  };
+
+ public:
+  CoTask(CoTask&& other) noexcept : handle_(std::exchange(other.handle_, {})) {}
+
+  CoTask& operator=(CoTask&& other) noexcept {
+    if (this != &other) {
+      if (handle_) {
+        handle_.destroy();
+      }
+      handle_ = std::exchange(other.handle_, {});
+    }
+    return *this;
+  }
+
+  ~CoTask() {
+    if (handle_) {
+      handle_.destroy();
+    }
+  }
+
+  Awaiter operator co_await() && { return Awaiter{handle_}; }
+  Awaiter operator co_await() & { return Awaiter{handle_}; }
+};
+
+template <typename T>
+CoTask<T> detail::CoTaskPromise<T>::get_return_object() {
+  return CoTask<T>(std::coroutine_handle<CoTaskPromise>::from_promise(*this));
+}
+
+inline CoTask<void> detail::CoTaskPromise<void>::get_return_object() {
+  return CoTask<void>(
+      std::coroutine_handle<CoTaskPromise>::from_promise(*this));
+}
+
+namespace detail {
+
+// A coroutine that starts right away and frees itself when it's done
+struct Detached {
+  struct promise_type {
+    Detached get_return_object() const noexcept { return {}; }
+    std::suspend_never initial_suspend() const noexcept { return {}; }
+    std::suspend_never final_suspend() const noexcept { return {}; }
+    void return_void() const noexcept {}
+    void unhandled_exception() const noexcept { std::terminate(); }
+  };
+};
+
+template <typename T>
+Detached run(ThreadPool& pool, CoTask<T> task, Promise<T> promise) {
+  co_await pool.schedule();
+  try {
+    if constexpr (std::is_void_v<T>) {
+      co_await std::move(task);
+      promise.set_value();
+    } else {
+      promise.set_value(co_await std::move(task));
+    }
+  } catch (...) {
+    promise.set_exception(std::current_exception());
+  }
+}
+
+}  // namespace detail
+
+// Runs a task on the pool from non-coroutine code. The future carries what
+// the task returns or throws.
+template <typename T>
+Future<T> start(ThreadPool& pool, CoTask<T> task) {
+  auto [future, promise] = pool.make_future<T>();
+  detail::run(pool, std::move(task), std::move(promise));
+  return std::move(future);
+}
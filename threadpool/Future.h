@@ -0,0 +1,240 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <future>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "Slab.h"
+
+// Where pools carve the shared state of their futures from. A state whose
+// value doesn't fit in a block goes to the heap instead.
+using FutureSlab = Slab<128>;
+
+// Tag for the submit() overload that returns a Future
+struct UseFuture {
+  explicit UseFuture() = default;
+};
+inline constexpr UseFuture use_future{};
+
+template <typename T>
+class Future;
+template <typename T>
+class Promise;
+
+// The state shared by a Future and its Promise. The result lives inline and
+// completion is a single 32-bit word, which waiters sleep on through
+// std::atomic::wait, i.e., a futex on Linux. The completing thread only makes
+// a syscall if someone is actually waiting.
+template <typename T>
+class FutureState {
+  static_assert(!std::is_reference_v<T>, "Future<T&> is not supported");
+
+  friend class Future<T>;
+  friend class Promise<T>;
+
+  struct Unit {};
+  using Value = std::conditional_t<std::is_void_v<T>, Unit, T>;
+
+  enum : uint32_t {
+    kPending,
+    kWaiting,  // Pending, and someone is sleeping on status_
+    kReady,
+  };
+  static constexpr uint32_t kHeap = UINT32_MAX;
+
+  std::atomic<uint32_t> status_{kPending};
+  std::atomic<uint32_t> refs_{2};  // One for the Future, one for the Promise
+  FutureSlab* slab_;
+  uint32_t slot_;
+  bool hasValue_{false};
+  std::exception_ptr error_;
+  union {
+    Value value_;
+  };
+
+  FutureState(FutureSlab* slab, uint32_t slot) : slab_(slab), slot_(slot) {}
+
+  ~FutureState() {
+    if (hasValue_) {
+      value_.~Value();
+    }
+  }
+
+  static FutureState* create(FutureSlab& slab) {
+    uint32_t slot = kHeap;
+    void* p = nullptr;
+    if constexpr (sizeof(FutureState) <= FutureSlab::kBlockSize &&
+                  alignof(FutureState) <= alignof(std::max_align_t)) {
+      p = slab.allocate(slot);
+    }
+    if (!p) {
+      slot = kHeap;
+      p = ::operator new(sizeof(FutureState));
+    }
+    return ::new (p) FutureState(&slab, slot);
+  }
+
+  void release() {
+    if (refs_.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+      return;
+    }
+    auto* slab = slab_;
+    const auto slot = slot_;
+    this->~FutureState();
+    if (slot == kHeap) {
+      ::operator delete(this);
+    } else {
+      slab->deallocate(slot);
+    }
+  }
+
+  void complete() {
+    if (status_.exchange(kReady, std::memory_order_acq_rel) == kWaiting) {
+      status_.notify_all();
+    }
+  }
+
+  bool ready() const {
+    return status_.load(std::memory_order_acquire) == kReady;
+  }
+
+  void wait() {
+    auto status = status_.load(std::memory_order_acquire);
+    while (status != kReady) {
+      if (status == kPending &&
+          !status_.compare_exchange_weak(status, kWaiting,
+                                         std::memory_order_acquire)) {
+        continue;
+      }
+      status_.wait(kWaiting, std::memory_order_acquire);
+      status = status_.load(std::memory_order_acquire);
+    }
+  }
+};
+
+// Write end of a future, owned by the task that computes the result. If it is
+// destroyed before the result is set, the future gets a broken_promise error.
+template <typename T>
+class Promise {
+  FutureState<T>* state_{nullptr};
+
+  explicit Promise(FutureState<T>* state) : state_(state) {}
+
+  void fulfil() {
+    auto* state = std::exchange(state_, nullptr);
+    state->complete();
+    state->release();
+  }
+
+  void abandon() {
+    if (state_) {
+      set_exception(std::make_exception_ptr(
+          std::future_error(std::future_errc::broken_promise)));
+    }
+  }
+
+ public:
+  Promise() = default;
+
+  Promise(Promise&& other) noexcept
+      : state_(std::exchange(other.state_, nullptr)) {}
+
+  Promise& operator=(Promise&& other) noexcept {
+    if (this != &other) {
+      abandon();
+      state_ = std::exchange(other.state_, nullptr);
+    }
+    return *this;
+  }
+
+  ~Promise() { abandon(); }
+
+  template <typename... Args>
+  void set_value(Args&&... args) {
+    ::new (&state_->value_)
+        typename FutureState<T>::Value(std::forward<Args>(args)...);
+    state_->hasValue_ = true;
+    fulfil();
+  }
+
+  void set_exception(std::exception_ptr error) {
+    state_->error_ = std::move(error);
+    fulfil();
+  }
+
+  // Runs f and stores whatever it returns or throws.
+  template <typename F>
+  void run(F& f) {
+    try {
+      if constexpr (std::is_void_v<T>) {
+        f();
+        set_value();
+      } else {
+        set_value(f());
+      }
+    } catch (...) {
+      set_exception(std::current_exception());
+    }
+  }
+
+  static std::pair<Future<T>, Promise<T>> create(FutureSlab& slab) {
+    auto* state = FutureState<T>::create(slab);
+    return {Future<T>(state), Promise<T>(state)};
+  }
+};
+
+// Read end of a future. Unlike std::future, the shared state comes from the
+// pool's slab, so a Future must not outlive the pool that created it.
+template <typename T>
+class Future {
+  friend class Promise<T>;
+
+  FutureState<T>* state_{nullptr};
+
+  explicit Future(FutureState<T>* state) : state_(state) {}
+
+ public:
+  Future() = default;
+
+  Future(Future&& other) noexcept
+      : state_(std::exchange(other.state_, nullptr)) {}
+
+  Future& operator=(Future&& other) noexcept {
+    if (this != &other) {
+      if (state_) {
+        state_->release();
+      }
+      state_ = std::exchange(other.state_, nullptr);
+    }
+    return *this;
+  }
+
+  ~Future() {
+    if (state_) {
+      state_->release();
+    }
+  }
+
+  bool valid() const { return state_ != nullptr; }
+
+  bool ready() const { return state_->ready(); }
+
+  void wait() const { state_->wait(); }
+
+  // Waits for the result and hands it over. Like std::future, this can only
+  // be called once.
+  T get() {
+    state_->wait();
+    Future self{std::move(*this)};
+    if (self.state_->error_) {
+      std::rethrow_exception(self.state_->error_);
+    }
+    if constexpr (!std::is_void_v<T>) {
+      return std::move(self.state_->value_);
+    }
+  }
+};
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <ctime>
+#include <thread>
+
+#include "../mutex/futex_wrapper.h"
+
+// Tells the CPU we're in a spin loop: saves power and frees up the pipeline
+// for the other hyper-thread of the core.
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  asm volatile("yield");
+#else
+  std::this_thread::yield();
+#endif
+}
+
+// What a worker does when it runs out of tasks. It first looks for work
+// 'spin' more times back to back, then 'backoff' more times with an
+// exponentially growing number of pauses in between, and then it parks until
+// someone submits something. With park = false it never sleeps, and yields
+// between attempts instead, which trades a busy core for wake-up latency.
+struct IdlePolicy {
+  unsigned spin = 64;
+  unsigned backoff = 10;
+  bool park = true;
+};
+
+// Keeps track of how long a worker has been idle.
+class Backoff {
+  const IdlePolicy policy_;
+  unsigned rounds_{0};
+
+ public:
+  explicit Backoff(const IdlePolicy& policy) : policy_(policy) {}
+
+  // Call after each failed attempt to find work. Returns true once it's time
+  // to park.
+  bool idle() {
+    if (rounds_ < policy_.spin) {
+      ++rounds_;
+      return false;
+    }
+    if (rounds_ < policy_.spin + policy_.backoff) {
+      // Stops growing at 2^31 pauses, so that any 'backoff' is fine.
+      const auto shift = std::min(rounds_ - policy_.spin, 31u);
+      for (unsigned n = 0; n != 1u << shift; ++n) {
+        cpu_relax();
+      }
+      ++rounds_;
+      return false;
+    }
+    if (!policy_.park) {
+      std::this_thread::yield();
+      return false;
+    }
+    return true;
+  }
+
+  // Call after finding work.
+  void reset() { rounds_ = 0; }
+};
+
+// Lets threads sleep until there might be work for them, without adding a
+// lock (or a syscall, when no one sleeps) to the path that submits work. This
+// is Dmitry Vyukov's eventcount. A worker that wants to sleep does:
+//
+//   auto key = events.prepare_wait();
+//   if (/* found work after all */) {
+//     events.cancel_wait();
+//   } else {
+//     events.wait(key);
+//   }
+//
+// and whoever publishes work calls notify_one() afterwards. Either the
+// notifier sees the waiter, or the waiter's last check sees the work.
+class EventCount {
+  std::atomic<uint32_t> epoch_{0};
+  std::atomic<uint32_t> waiters_{0};
+
+  uint32_t* futex() { return reinterpret_cast<uint32_t*>(&epoch_); }
+
+  void notify(bool one) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiters_.load(std::memory_order_relaxed) == 0) {
+      return;
+    }
+    epoch_.fetch_add(1, std::memory_order_release);
+    futex_wake(futex(), one);
+  }
+
+ public:
+  uint32_t prepare_wait() {
+    waiters_.fetch_add(1, std::memory_order_seq_cst);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    return epoch_.load(std::memory_order_acquire);
+  }
+
+  void cancel_wait() { waiters_.fetch_sub(1, std::memory_order_relaxed); }
+
+  // Sleeps until a notification newer than 'key' arrives. With a timeout,
+  // returns false if it expires first.
+  bool wait(uint32_t key, const timespec* timeout = nullptr) {
+    bool notified = true;
+    while (epoch_.load(std::memory_order_acquire) == key) {
+      if (futex_wait(futex(), key, timeout) == -1 && errno == ETIMEDOUT) {
+        notified = epoch_.load(std::memory_order_acquire) != key;
+        break;
+      }
+    }
+    waiters_.fetch_sub(1, std::memory_order_relaxed);
+    return notified;
+  }
+
+  // Wakes up one sleeping thread, if there is any.
+  void notify_one() { notify(true); }
+
+  void notify_all() { notify(false); }
+
+  // Only a hint
+  unsigned waiters() const { return waiters_.load(std::memory_order_relaxed); }
+};
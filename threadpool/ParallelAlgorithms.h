@@ -0,0 +1,205 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <numeric>
+#include <ranges>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "ThreadPool.h"
+
+// Data-parallel versions of a few standard algorithms, on a ThreadPool. The
+// input is cut into a few blocks per worker, and each block is handled by the
+// sequential standard algorithm. Small inputs skip the pool altogether. Like
+// their std:: counterparts, the operations must be associative where it
+// matters, but need not be commutative: blocks are always combined in order.
+
+namespace detail {
+
+// Inputs shorter than this aren't worth splitting
+inline constexpr size_t kMinBlock = 1 << 14;
+
+// How many blocks to cut n elements into
+inline size_t blocksFor(const ThreadPool& pool, size_t n) {
+  return std::clamp<size_t>(n / kMinBlock, 1, 4 * size_t{pool.size()});
+}
+
+// Runs fn(b, lo, hi) for each of the 'blocks' blocks of [0, n).
+template <typename F>
+void forEachBlock(ThreadPool& pool, size_t n, size_t blocks, F&& fn) {
+  if (blocks == 1) {
+    fn(size_t{0}, size_t{0}, n);
+    return;
+  }
+  pool.parallel_for(std::views::iota(size_t{0}, blocks), 1, [&](size_t b) {
+    fn(b, n * b / blocks, n * (b + 1) / blocks);
+  });
+}
+
+// Finds how many of the first k elements of merge(a, b) come from a, with
+// elements of a going first on ties, like std::merge does. This is the
+// "merge path" split, which lets pieces of one merge run in parallel.
+template <typename It, typename Compare>
+size_t mergeSplit(It a, size_t m, It b, size_t n, size_t k, Compare& comp) {
+  auto lo = k > n ? k - n : 0;
+  auto hi = std::min(k, m);
+  while (true) {
+    const auto i = lo + (hi - lo) / 2;
+    const auto j = k - i;
+    if (i > 0 && j < n && comp(b[j], a[i - 1])) {
+      hi = i - 1;
+    } else if (j > 0 && i < m && !comp(b[j - 1], a[i])) {
+      lo = i + 1;
+    } else {
+      return i;
+    }
+  }
+}
+
+}  // namespace detail
+
+// Sets out[i] = fn(in[i]) for every element of in, and returns the end of
+// the output.
+template <std::ranges::random_access_range R, std::random_access_iterator O,
+          typename F>
+O parallel_transform(ThreadPool& pool, R&& in, O out, F fn) {
+  auto first = std::ranges::begin(in);
+  const auto n = static_cast<size_t>(std::ranges::distance(in));
+  detail::forEachBlock(pool, n, detail::blocksFor(pool, n),
+                       [&](size_t, size_t lo, size_t hi) {
+                         std::transform(first + lo, first + hi, out + lo, fn);
+                       });
+  return out + n;
+}
+
+// Folds the range into init with op, e.g., parallel_reduce(pool, v, 0L).
+template <std::ranges::random_access_range R, typename T,
+          typename Op = std::plus<>>
+T parallel_reduce(ThreadPool& pool, R&& range, T init, Op op = {}) {
+  auto first = std::ranges::begin(range);
+  const auto n = static_cast<size_t>(std::ranges::distance(range));
+  const auto blocks = detail::blocksFor(pool, n);
+  if (n == 0) {
+    return init;
+  }
+  // Each block starts from its own first element, so we don't need an
+  // identity for op.
+  std::vector<T> partial(blocks, init);
+  detail::forEachBlock(pool, n, blocks, [&](size_t b, size_t lo, size_t hi) {
+    partial[b] = std::accumulate(first + lo + 1, first + hi, T(first[lo]), op);
+  });
+  for (auto& x : partial) {
+    init = op(std::move(init), std::move(x));
+  }
+  return init;
+}
+
+// Writes the running totals of the range to out, out[i] being the sum of
+// in[0..i]. out may be the beginning of in. Two passes over the data: the
+// first sums up each block, the second scans each block again, starting from
+// the sum of the blocks before it.
+template <std::ranges::random_access_range R, std::random_access_iterator O,
+          typename Op = std::plus<>>
+O parallel_inclusive_scan(ThreadPool& pool, R&& in, O out, Op op = {}) {
+  using T = std::iter_value_t<std::ranges::iterator_t<R>>;
+  auto first = std::ranges::begin(in);
+  const auto n = static_cast<size_t>(std::ranges::distance(in));
+  const auto blocks = detail::blocksFor(pool, n);
+  if (blocks == 1) {
+    return std::inclusive_scan(first, first + n, out, op);
+  }
+  std::vector<T> sums(blocks);
+  detail::forEachBlock(pool, n, blocks, [&](size_t b, size_t lo, size_t hi) {
+    sums[b] = std::accumulate(first + lo + 1, first + hi, T(first[lo]), op);
+  });
+  std::inclusive_scan(sums.begin(), sums.end(), sums.begin(), op);
+  detail::forEachBlock(pool, n, blocks, [&](size_t b, size_t lo, size_t hi) {
+    if (b == 0) {
+      std::inclusive_scan(first + lo, first + hi, out + lo, op);
+    } else {
+      std::inclusive_scan(first + lo, first + hi, out + lo, op, sums[b - 1]);
+    }
+  });
+  return out + n;
+}
+
+// Sorts the range, not stably, like std::sort. Each block is sorted on its
+// own, then runs are merged pairwise, back and forth between the range and a
+// buffer, with every merge split into pieces along its merge path so that
+// the last rounds keep all the workers busy too.
+template <std::ranges::random_access_range R, typename Compare = std::less<>>
+void parallel_sort(ThreadPool& pool, R&& range, Compare comp = {}) {
+  using T = std::ranges::range_value_t<R>;
+  auto first = std::ranges::begin(range);
+  const auto n = static_cast<size_t>(std::ranges::distance(range));
+  const auto blocks = detail::blocksFor(pool, n);
+  if (blocks == 1) {
+    std::sort(first, first + n, comp);
+    return;
+  }
+  detail::forEachBlock(pool, n, blocks, [&](size_t, size_t lo, size_t hi) {
+    std::sort(first + lo, first + hi, comp);
+  });
+
+  // Runs are made of whole blocks, so that their bounds match the sort's.
+  auto bound = [&](size_t b) { return n * std::min(b, blocks) / blocks; };
+  std::vector<T> buffer(n);
+  bool inBuffer = false;
+  for (size_t width = 1; width < blocks; width *= 2) {
+    const size_t pairs = (blocks + 2 * width - 1) / (2 * width);
+    // Pieces per pair, so that every round has about 'blocks' pieces
+    const size_t pieces = std::max<size_t>(1, blocks / pairs);
+    // Where piece k of a pair starts in the output and in the pair's first
+    // run. All the splits are found before any piece moves elements out.
+    auto runs = [&](size_t k) {
+      const auto pair = k / pieces * 2 * width;
+      return std::tuple(bound(pair), bound(pair + width),
+                        bound(pair + 2 * width));
+    };
+    std::vector<std::pair<size_t, size_t>> splits(pairs * pieces + 1);
+    auto split = [&](auto src) {
+      for (size_t k = 0; k != pairs * pieces; ++k) {
+        const auto [lo, mid, hi] = runs(k);
+        const auto from = (hi - lo) * (k % pieces) / pieces;
+        splits[k] = {from, detail::mergeSplit(src + lo, mid - lo, src + mid,
+                                              hi - mid, from, comp)};
+      }
+    };
+    // Merges piece k of the round's output from src into dst.
+    auto merge = [&](auto src, auto dst, size_t k) {
+      const auto [lo, mid, hi] = runs(k);
+      const auto [from, i] = splits[k];
+      auto [to, j] = splits[k + 1];
+      if (k % pieces == pieces - 1) {
+        to = hi - lo;
+        j = mid - lo;
+      }
+      const auto a = src + lo;
+      const auto b = src + mid;
+      std::merge(std::make_move_iterator(a + i), std::make_move_iterator(a + j),
+                 std::make_move_iterator(b + (from - i)),
+                 std::make_move_iterator(b + (to - j)), dst + lo + from, comp);
+    };
+    if (inBuffer) {
+      split(buffer.begin());
+    } else {
+      split(first);
+    }
+    detail::forEachBlock(pool, pairs * pieces, pairs * pieces,
+                         [&](size_t k, size_t, size_t) {
+                           if (inBuffer) {
+                             merge(buffer.begin(), first, k);
+                           } else {
+                             merge(first, buffer.begin(), k);
+                           }
+                         });
+    inBuffer = !inBuffer;
+  }
+  if (inBuffer) {
+    parallel_transform(pool, buffer, first, [](T& x) { return std::move(x); });
+  }
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+// Thread-safe allocator of fixed-size blocks. Blocks are carved out of chunks
+// that live as long as the slab does, and free blocks are kept in a lock-free
+// stack. The stack head packs the index of the top block with a counter that
+// changes on every update, which protects us from the ABA problem. The links
+// are kept apart from the blocks themselves, so a thread that lost a race
+// never reads memory that someone else is writing to.
+template <size_t BlockSize, size_t BlocksPerChunk = 256, size_t MaxChunks = 1024>
+class Slab {
+  static constexpr uint32_t kNil = UINT32_MAX;
+
+  struct Chunk {
+    struct alignas(std::max_align_t) Block {
+      unsigned char bytes[BlockSize];
+    };
+    Block blocks[BlocksPerChunk];
+    std::atomic<uint32_t> next[BlocksPerChunk];
+  };
+
+  std::atomic<uint64_t> head_{kNil};
+  std::unique_ptr<std::atomic<Chunk*>[]> chunks_{
+      new std::atomic<Chunk*>[MaxChunks]()};
+  size_t nchunks_{0};  // Protected by mutex_
+  std::mutex mutex_;
+
+  Chunk* chunk(uint32_t slot) const {
+    return chunks_[slot / BlocksPerChunk].load(std::memory_order_acquire);
+  }
+
+  std::atomic<uint32_t>& next(uint32_t slot) const {
+    return chunk(slot)->next[slot % BlocksPerChunk];
+  }
+
+  static uint64_t pack(uint64_t head, uint32_t slot) {
+    return ((head >> 32) + 1) << 32 | slot;
+  }
+
+  // Adds a new chunk to the free list. Returns false once we reach MaxChunks.
+  bool grow() {
+    std::lock_guard<std::mutex> lock{mutex_};
+    if (static_cast<uint32_t>(head_.load(std::memory_order_relaxed)) != kNil) {
+      // Someone else grew the slab while we were waiting for the lock
+      return true;
+    }
+    if (nchunks_ == MaxChunks) {
+      return false;
+    }
+    chunks_[nchunks_].store(new Chunk, std::memory_order_release);
+    const auto first = static_cast<uint32_t>(nchunks_ * BlocksPerChunk);
+    ++nchunks_;
+    for (uint32_t slot = first; slot != first + BlocksPerChunk; ++slot) {
+      deallocate(slot);
+    }
+    return true;
+  }
+
+ public:
+  static constexpr size_t kBlockSize = BlockSize;
+
+  Slab() = default;
+
+  // Avoid copying
+  Slab(const Slab&) = delete;
+  Slab& operator=(const Slab&) = delete;
+
+  ~Slab() {
+    for (size_t n = 0; n != nchunks_; ++n) {
+      delete chunks_[n].load(std::memory_order_relaxed);
+    }
+  }
+
+  // Returns a block of BlockSize bytes and its slot number, which is what
+  // deallocate() takes. Returns nullptr if the slab is exhausted.
+  void* allocate(uint32_t& slot) {
+    auto head = head_.load(std::memory_order_acquire);
+    while (true) {
+      slot = static_cast<uint32_t>(head);
+      if (slot == kNil) {
+        if (!grow()) {
+          return nullptr;
+        }
+        head = head_.load(std::memory_order_acquire);
+        continue;
+      }
+      const auto nextSlot = next(slot).load(std::memory_order_relaxed);
+      if (head_.compare_exchange_weak(head, pack(head, nextSlot),
+                                      std::memory_order_acquire,
+                                      std::memory_order_acquire)) {
+        return chunk(slot)->blocks[slot % BlocksPerChunk].bytes;
+      }
+    }
+  }
+
+  void deallocate(uint32_t slot) {
+    auto head = head_.load(std::memory_order_relaxed);
+    do {
+      next(slot).store(static_cast<uint32_t>(head), std::memory_order_relaxed);
+    } while (!head_.compare_exchange_weak(head, pack(head, slot),
+                                          std::memory_order_release,
+                                          std::memory_order_relaxed));
+  }
+};
@@ -0,0 +1,216 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "Task.h"
+
+// What one worker has been up to. Wait times are in a histogram of powers of
+// two: bucket b counts the tasks that sat in the pool for [2^(b-1), 2^b) ns.
+struct WorkerStats {
+  static constexpr size_t kWaitBuckets = 40;
+
+  uint64_t executed{0};
+  uint64_t spawned{0};         // Tasks the worker pushed to its own deque
+  uint64_t local_pops{0};      // Tasks taken from the worker's own deque
+  uint64_t steal_attempts{0};  // Tries at another worker's deque or queue
+  uint64_t steals{0};          // ...that got us some work
+  uint64_t parks{0};
+  uint64_t unparks{0};
+  uint64_t idle_ns{0};  // Time spent looking for work or parked
+  std::array<uint64_t, kWaitBuckets> wait{};
+
+  WorkerStats& operator+=(const WorkerStats& other) {
+    executed += other.executed;
+    spawned += other.spawned;
+    local_pops += other.local_pops;
+    steal_attempts += other.steal_attempts;
+    steals += other.steals;
+    parks += other.parks;
+    unparks += other.unparks;
+    idle_ns += other.idle_ns;
+    for (size_t b = 0; b != kWaitBuckets; ++b) {
+      wait[b] += other.wait[b];
+    }
+    return *this;
+  }
+
+  uint64_t waitSamples() const {
+    uint64_t n = 0;
+    for (auto count : wait) {
+      n += count;
+    }
+    return n;
+  }
+
+  // Upper bound, in ns, of the wait of the q-th quantile (0 <= q <= 1) of
+  // the sampled tasks.
+  uint64_t waitPercentile(double q) const {
+    const auto total = waitSamples();
+    if (total == 0) {
+      return 0;
+    }
+    const auto target =
+        std::min<uint64_t>(static_cast<uint64_t>(q * total), total - 1);
+    uint64_t seen = 0;
+    for (size_t b = 0; b != kWaitBuckets; ++b) {
+      seen += wait[b];
+      if (seen > target) {
+        return uint64_t{1} << b;
+      }
+    }
+    return 0;
+  }
+};
+
+// A snapshot of a pool's counters. Lock contention is counted per queue, not
+// per worker, since it's mostly the submitting threads that run into it.
+struct PoolStats {
+  std::vector<WorkerStats> workers;
+  uint64_t push_contended{0};  // try_push that found the queue locked
+  uint64_t pop_contended{0};   // try_pop that found the queue locked
+
+  WorkerStats total() const {
+    WorkerStats sum;
+    for (auto& w : workers) {
+      sum += w;
+    }
+    return sum;
+  }
+};
+
+// The live counters of one worker, on a cache line of their own. Only the
+// worker writes them, so an update is a plain load and store rather than a
+// locked instruction, and anyone can read them at any time.
+class alignas(64) WorkerCounters {
+  using Clock = std::chrono::steady_clock;
+
+  // Every kWaitSampleRate-th task submitted by a thread gets its wait time
+  // measured.
+  static constexpr unsigned kWaitSampleRate = 64;
+
+  std::atomic<uint64_t> executed_{0};
+  std::atomic<uint64_t> spawned_{0};
+  std::atomic<uint64_t> localPops_{0};
+  std::atomic<uint64_t> stealAttempts_{0};
+  std::atomic<uint64_t> steals_{0};
+  std::atomic<uint64_t> parks_{0};
+  std::atomic<uint64_t> unparks_{0};
+  std::atomic<uint64_t> idleNs_{0};
+  std::array<std::atomic<uint64_t>, WorkerStats::kWaitBuckets> wait_{};
+  Clock::time_point idleSince_{};
+  bool idle_{false};
+
+  static void bump(std::atomic<uint64_t>& counter, uint64_t n = 1) {
+    counter.store(counter.load(std::memory_order_relaxed) + n,
+                  std::memory_order_relaxed);
+  }
+
+  static uint64_t nanoseconds(Clock::duration d) {
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(d).count());
+  }
+
+ public:
+  // The counters of the worker running on this thread, if any
+  static inline thread_local WorkerCounters* current = nullptr;
+
+  // Release, so that whoever reads the count also sees what the task did
+  void executed() {
+    executed_.store(executed_.load(std::memory_order_relaxed) + 1,
+                    std::memory_order_release);
+  }
+  void spawned() { bump(spawned_); }
+  void localPop() { bump(localPops_); }
+  void stealAttempt(bool success) {
+    bump(stealAttempts_);
+    if (success) {
+      bump(steals_);
+    }
+  }
+  void parked() { bump(parks_); }
+  void unparked() { bump(unparks_); }
+
+  // Call when the worker fails to find work, and when it finds some.
+  void idle() {
+    if (!idle_) {
+      idle_ = true;
+      idleSince_ = Clock::now();
+    }
+  }
+  void busy() {
+    if (idle_) {
+      idle_ = false;
+      bump(idleNs_, nanoseconds(Clock::now() - idleSince_));
+    }
+  }
+
+  // Runs f after recording how long it waited to start. Holds f itself
+  // rather than a Task of it, so that it fits inline in a Task whenever f
+  // leaves room for the time stamp.
+  template <typename F>
+  struct Timed {
+    F f;
+    Clock::time_point start;
+
+    void operator()() {
+      if (current) {
+        const auto ns = nanoseconds(Clock::now() - start);
+        bump(current->wait_[std::min<size_t>(
+            std::bit_width(ns), WorkerStats::kWaitBuckets - 1)]);
+      }
+      f();
+    }
+  };
+
+  // Whether timing an F costs no allocation that submitting it untimed
+  // wouldn't: both fit inline in a Task, or neither does. A Task is moved
+  // as is, so timing it would always allocate.
+  template <typename F>
+  static constexpr bool timeable() {
+    using Fn = std::decay_t<F>;
+    return !std::is_same_v<Fn, Task> &&
+           Task::storedInline<Timed<Fn>>() == Task::storedInline<Fn>();
+  }
+
+  // Whether to measure the wait of the F the calling thread is about to
+  // submit. Cheap enough to call on every submission.
+  template <typename F>
+  static bool sample() {
+    if constexpr (timeable<F>()) {
+      static thread_local unsigned submitted = 0;
+      return ++submitted % kWaitSampleRate == 0;
+    } else {
+      return false;
+    }
+  }
+
+  template <typename F>
+  static Timed<std::decay_t<F>> timed(F&& f) {
+    return {std::forward<F>(f), Clock::now()};
+  }
+
+  WorkerStats snapshot() const {
+    WorkerStats s;
+    s.executed = executed_.load(std::memory_order_acquire);
+    s.spawned = spawned_.load(std::memory_order_relaxed);
+    s.local_pops = localPops_.load(std::memory_order_relaxed);
+    s.steal_attempts = stealAttempts_.load(std::memory_order_relaxed);
+    s.steals = steals_.load(std::memory_order_relaxed);
+    s.parks = parks_.load(std::memory_order_relaxed);
+    s.unparks = unparks_.load(std::memory_order_relaxed);
+    s.idle_ns = idleNs_.load(std::memory_order_relaxed);
+    for (size_t b = 0; b != WorkerStats::kWaitBuckets; ++b) {
+      s.wait[b] = wait_[b].load(std::memory_order_relaxed);
+    }
+    return s;
+  }
+};
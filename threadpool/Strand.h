@@ -0,0 +1,144 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <new>
+#include <utility>
+
+#include "../ring-buffer/MpscQueue.h"
+#include "ThreadPool.h"
+
+// Runs the tasks posted to it one at a time, in the order they were posted,
+// on a ThreadPool. Different strands run in parallel, so a strand per
+// connection (or shard, or whatever owns some state) replaces a mutex around
+// that state:
+//
+//   Strand strand(pool);
+//   strand.post([&] { connection.write(data); });
+//
+// Posting pushes the task onto a wait-free IntrusiveMpscQueue, and only the
+// post that finds the strand empty submits it to the pool. The worker that
+// picks it up then runs up to kBatch tasks in a row, with the strand's state
+// warm in its cache, before it lets other work have a go.
+//
+// Nodes come from the pool's slab, so posting doesn't allocate either. If a
+// task throws, the strand hands the exception to its error handler and goes
+// on with the next task: it never reaches the pool, whose tasks must not
+// throw.
+//
+// The strand must outlive the tasks posted to it.
+class Strand {
+ public:
+  // Tasks a worker runs before it gives the strand back to the pool
+  static constexpr size_t kBatch = 64;
+
+ private:
+  // The slot of a node that didn't fit in the slab
+  static constexpr uint32_t kHeap = UINT32_MAX;
+
+  struct Node : MpscNode {
+    Task task;
+    uint32_t slot;
+
+    Node(Task&& t, uint32_t s) : task(std::move(t)), slot(s) {}
+  };
+
+  ThreadPool& pool_;
+  const std::function<void(std::exception_ptr)> onError_;
+  IntrusiveMpscQueue queue_;
+  // Tasks posted and not yet run. The post that raises it from 0 schedules
+  // the strand.
+  alignas(64) std::atomic<size_t> pending_{0};
+
+  // Only one thread (the one running the strand) pops at a time.
+  Node* pop() { return static_cast<Node*>(queue_.pop()); }
+
+  Node* allocate(Task&& task) {
+    uint32_t slot = kHeap;
+    void* p = nullptr;
+    if constexpr (sizeof(Node) <= FutureSlab::kBlockSize &&
+                  alignof(Node) <= alignof(std::max_align_t)) {
+      p = pool_.futures_.allocate(slot);
+    }
+    if (!p) {
+      slot = kHeap;
+      p = ::operator new(sizeof(Node));
+    }
+    return ::new (p) Node(std::move(task), slot);
+  }
+
+  void release(Node* node) {
+    const auto slot = node->slot;
+    node->~Node();
+    if (slot == kHeap) {
+      ::operator delete(node);
+    } else {
+      pool_.futures_.deallocate(slot);
+    }
+  }
+
+  void schedule() {
+    pool_.submit([this] { drain(); });
+  }
+
+  void drain() {
+    size_t ran = 0;
+    for (auto posted = pending_.load(std::memory_order_acquire);
+         ran != kBatch;) {
+      if (ran == posted) {
+        posted = pending_.load(std::memory_order_acquire);
+        if (ran == posted) {
+          break;
+        }
+      }
+      // The task was counted, so it's in the queue or about to be.
+      Node* node;
+      while (!(node = pop())) {
+        cpu_relax();
+      }
+      try {
+        node->task();
+      } catch (...) {
+        if (onError_) {
+          onError_(std::current_exception());
+        }
+      }
+      release(node);
+      ++ran;
+    }
+    if (pending_.fetch_sub(ran, std::memory_order_acq_rel) != ran) {
+      // More were posted meanwhile. Go to the back of the pool's line.
+      schedule();
+    }
+  }
+
+ public:
+  // onError gets the exceptions that tasks throw, on the worker running the
+  // strand, and must not throw itself. Without it, they're dropped.
+  explicit Strand(ThreadPool& pool,
+                  std::function<void(std::exception_ptr)> onError = {})
+      : pool_(pool), onError_(std::move(onError)) {}
+
+  // Avoid copying
+  Strand(const Strand&) = delete;
+  Strand& operator=(const Strand&) = delete;
+
+  ~Strand() { assert(pending_.load(std::memory_order_acquire) == 0); }
+
+  // Runs f on the pool after every task posted to the strand before it, and
+  // never at the same time as another task of the strand.
+  template <typename F>
+  void post(F&& f) {
+    queue_.push(allocate(Task(std::forward<F>(f))));
+    if (pending_.fetch_add(1, std::memory_order_acq_rel) == 0) {
+      schedule();
+    }
+  }
+
+  // Whether the strand has tasks it hasn't run yet. Only a hint.
+  bool busy() const { return pending_.load(std::memory_order_relaxed) != 0; }
+};
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Move-only replacement for std::function<void()>. Callables of up to
+// InlineSize bytes are stored inline, so wrapping them never allocates, and
+// unlike std::function they don't have to be copyable (a lambda capturing a
+// std::unique_ptr is fine). Bigger callables still work, but go to the heap.
+template <size_t InlineSize>
+class BasicTask {
+  enum class Op { Move, Destroy };
+
+  using Invoke = void (*)(void* storage);
+  // Move: move-constructs the callable in 'storage' from the one in 'other'
+  // and destroys the latter. Destroy: destroys the callable in 'storage'.
+  using Manage = void (*)(Op op, void* storage, void* other);
+
+  template <typename F>
+  static constexpr bool kFitsInline =
+      sizeof(F) <= InlineSize && alignof(F) <= alignof(std::max_align_t) &&
+      std::is_nothrow_move_constructible_v<F>;
+
+  alignas(std::max_align_t) unsigned char storage_[InlineSize];
+  Invoke invoke_{nullptr};
+  Manage manage_{nullptr};
+
+  template <typename F>
+  static void invokeInline(void* storage) {
+    (*std::launder(static_cast<F*>(storage)))();
+  }
+
+  template <typename F>
+  static void manageInline(Op op, void* storage, void* other) {
+    if (op == Op::Move) {
+      auto* src = std::launder(static_cast<F*>(other));
+      ::new (storage) F(std::move(*src));
+      src->~F();
+    } else {
+      std::launder(static_cast<F*>(storage))->~F();
+    }
+  }
+
+  template <typename F>
+  static void invokeHeap(void* storage) {
+    (**static_cast<F**>(storage))();
+  }
+
+  template <typename F>
+  static void manageHeap(Op op, void* storage, void* other) {
+    if (op == Op::Move) {
+      *static_cast<F**>(storage) = *static_cast<F**>(other);
+    } else {
+      delete *static_cast<F**>(storage);
+    }
+  }
+
+  void moveFrom(BasicTask& other) noexcept {
+    if (other.manage_) {
+      other.manage_(Op::Move, storage_, other.storage_);
+      invoke_ = std::exchange(other.invoke_, nullptr);
+      manage_ = std::exchange(other.manage_, nullptr);
+    }
+  }
+
+  void reset() noexcept {
+    if (manage_) {
+      manage_(Op::Destroy, storage_, nullptr);
+      invoke_ = nullptr;
+      manage_ = nullptr;
+    }
+  }
+
+ public:
+  static constexpr size_t kInlineSize = InlineSize;
+
+  BasicTask() noexcept = default;
+
+  template <typename F>
+    requires(!std::is_same_v<std::decay_t<F>, BasicTask> &&
+             std::is_invocable_v<std::decay_t<F>&>)
+  BasicTask(F&& f) {
+    using Fn = std::decay_t<F>;
+    if constexpr (kFitsInline<Fn>) {
+      ::new (static_cast<void*>(storage_)) Fn(std::forward<F>(f));
+      invoke_ = &invokeInline<Fn>;
+      manage_ = &manageInline<Fn>;
+    } else {
+      ::new (static_cast<void*>(storage_)) Fn*(new Fn(std::forward<F>(f)));
+      invoke_ = &invokeHeap<Fn>;
+      manage_ = &manageHeap<Fn>;
+    }
+  }
+
+  BasicTask(BasicTask&& other) noexcept { moveFrom(other); }
+
+  BasicTask& operator=(BasicTask&& other) noexcept {
+    if (this != &other) {
+      reset();
+      moveFrom(other);
+    }
+    return *this;
+  }
+
+  BasicTask(const BasicTask&) = delete;
+  BasicTask& operator=(const BasicTask&) = delete;
+
+  ~BasicTask() { reset(); }
+
+  explicit operator bool() const noexcept { return invoke_ != nullptr; }
+
+  void operator()() { invoke_(storage_); }
+
+  // Whether wrapping an F avoids the heap
+  template <typename F>
+  static constexpr bool storedInline() {
+    return kFitsInline<std::decay_t<F>>;
+  }
+};
+
+// Sized so that a Task, inline buffer plus its two function pointers, fills
+// exactly one cache line.
+inline constexpr size_t kTaskInlineSize = 64 - 2 * sizeof(void*);
+
+using Task = BasicTask<kTaskInlineSize>;
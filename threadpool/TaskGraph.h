@@ -0,0 +1,134 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <utility>
+#include <vector>
+
+#include "ThreadPool.h"
+
+// A set of tasks and the dependencies between them, run on a ThreadPool:
+//
+//   TaskGraph graph;
+//   auto load = graph.add_node([] { ... });
+//   auto parse = graph.add_node([] { ... });
+//   graph.add_edge(load, parse);  // parse runs after load
+//   graph.run(pool).get();
+//
+// Every node counts its pending predecessors, and the one that brings a
+// successor's counter to zero releases it. The first successor released by a
+// node runs right away on the same worker, while its inputs are still in the
+// cache. Any others are submitted to the pool.
+//
+// Building the graph allocates, running it doesn't, so a graph can be built
+// once and run many times. Runs of the same graph must not overlap, and the
+// graph must not have cycles.
+class TaskGraph {
+  struct Node {
+    Task work;
+    std::vector<size_t> successors;
+    size_t predecessors{0};
+    std::atomic<size_t> pending{0};
+
+    explicit Node(Task&& work) : work(std::move(work)) {}
+  };
+
+  // A deque, so that nodes never move while we add more
+  std::deque<Node> nodes_;
+  std::vector<Node*> sources_;
+  std::atomic<size_t> remaining_{0};
+  std::atomic<bool> failed_{false};
+  std::exception_ptr error_;
+  Promise<void> promise_;
+
+  void execute(ThreadPool& pool, Node* node) {
+    while (node) {
+      // Once a node fails we skip the work of the others, but still go
+      // through the graph so that the run finishes.
+      if (!failed_.load(std::memory_order_relaxed)) {
+        try {
+          node->work();
+        } catch (...) {
+          if (!failed_.exchange(true)) {
+            error_ = std::current_exception();
+          }
+        }
+      }
+      Node* next = nullptr;
+      for (auto s : node->successors) {
+        auto* succ = &nodes_[s];
+        if (succ->pending.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+          continue;
+        }
+        if (!next) {
+          next = succ;
+        } else {
+          pool.submit([this, &pool, succ] { execute(pool, succ); });
+        }
+      }
+      if (remaining_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        // That was the last node. The graph may be run again (or destroyed)
+        // as soon as we complete the promise, so we don't touch it after.
+        auto promise = std::move(promise_);
+        if (error_) {
+          promise.set_exception(std::exchange(error_, nullptr));
+        } else {
+          promise.set_value();
+        }
+        return;
+      }
+      node = next;
+    }
+  }
+
+ public:
+  TaskGraph() = default;
+
+  // Avoid copying
+  TaskGraph(const TaskGraph&) = delete;
+  TaskGraph& operator=(const TaskGraph&) = delete;
+
+  // Adds a node and returns its id. f runs once per run of the graph.
+  template <typename F>
+  size_t add_node(F&& f) {
+    nodes_.emplace_back(Task(std::forward<F>(f)));
+    return nodes_.size() - 1;
+  }
+
+  // 'to' runs after 'from' is done.
+  void add_edge(size_t from, size_t to) {
+    assert(from < nodes_.size() && to < nodes_.size() && from != to);
+    nodes_[from].successors.push_back(to);
+    ++nodes_[to].predecessors;
+  }
+
+  size_t size() const { return nodes_.size(); }
+
+  // Starts running the graph on the pool. The future completes when every
+  // node is done, and carries the first exception thrown by any of them.
+  Future<void> run(ThreadPool& pool) {
+    auto [future, promise] = pool.make_future<void>();
+    if (nodes_.empty()) {
+      promise.set_value();
+      return std::move(future);
+    }
+    sources_.clear();
+    for (auto& node : nodes_) {
+      node.pending.store(node.predecessors, std::memory_order_relaxed);
+      if (node.predecessors == 0) {
+        sources_.push_back(&node);
+      }
+    }
+    assert(!sources_.empty());
+    failed_.store(false, std::memory_order_relaxed);
+    promise_ = std::move(promise);
+    remaining_.store(nodes_.size(), std::memory_order_release);
+    for (auto* node : sources_) {
+      pool.submit([this, &pool, node] { execute(pool, node); });
+    }
+    return std::move(future);
+  }
+};
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <utility>
+
+#include "ThreadPool.h"
+
+// A set of tasks to wait for, for fork-join code on a ThreadPool:
+//
+//   long fib(ThreadPool& pool, int n) {
+//     if (n < 2) return n;
+//     long a, b;
+//     TaskGroup group(pool);
+//     group.run([&] { a = fib(pool, n - 1); });
+//     b = fib(pool, n - 2);
+//     group.wait();
+//     return a + b;
+//   }
+//
+// A worker that waits on a group runs other tasks in the meantime, so nested
+// groups neither block a thread nor deadlock the pool. Anyone else blocks.
+// Tasks may add more tasks to their own group while it's being waited on.
+class TaskGroup {
+  // Twice the number of pending tasks, plus one if someone outside the pool
+  // is sleeping on it
+  static constexpr uint32_t kWaiting = 1;
+  static constexpr uint32_t kTask = 2;
+
+  ThreadPool& pool_;
+  std::atomic<uint32_t> pending_{0};
+  // Set by the last task to finish once it no longer touches the group, if
+  // someone was sleeping on it, so that they don't destroy it under its feet
+  std::atomic<bool> released_{false};
+  std::atomic<bool> failed_{false};
+  std::exception_ptr error_;
+
+  void finish() {
+    if (pending_.fetch_sub(kTask, std::memory_order_acq_rel) ==
+        kTask + kWaiting) {
+      pending_.notify_all();
+      released_.store(true, std::memory_order_release);
+    }
+  }
+
+  void block() {
+    auto pending = pending_.load(std::memory_order_acquire);
+    while (pending >= kTask) {
+      if (!(pending & kWaiting) &&
+          !pending_.compare_exchange_weak(pending, pending | kWaiting,
+                                          std::memory_order_acquire)) {
+        continue;
+      }
+      pending_.wait(pending | kWaiting, std::memory_order_acquire);
+      pending = pending_.load(std::memory_order_acquire);
+    }
+  }
+
+ public:
+  explicit TaskGroup(ThreadPool& pool) : pool_(pool) {}
+
+  // Avoid copying
+  TaskGroup(const TaskGroup&) = delete;
+  TaskGroup& operator=(const TaskGroup&) = delete;
+
+  // Waits for the tasks that are left, but drops their exceptions.
+  ~TaskGroup() {
+    try {
+      wait();
+    } catch (...) {
+    }
+  }
+
+  // Runs f on the pool, as part of the group.
+  template <typename F>
+  void run(F&& f) {
+    pending_.fetch_add(kTask, std::memory_order_relaxed);
+    pool_.submit([this, f = std::forward<F>(f)]() mutable {
+      // Once a task fails we skip the others, like TaskGraph does.
+      if (!failed_.load(std::memory_order_relaxed)) {
+        try {
+          f();
+        } catch (...) {
+          if (!failed_.exchange(true)) {
+            error_ = std::current_exception();
+          }
+        }
+      }
+      finish();
+    });
+  }
+
+  // Returns once every task of the group is done, and rethrows the first
+  // exception any of them threw. The group can be used again afterwards. Only
+  // one thread may wait on a group at a time.
+  void wait() {
+    if (ThreadPool::currentPool_ == &pool_) {
+      pool_.helpUntil([this] {
+        return pending_.load(std::memory_order_acquire) < kTask;
+      });
+    } else {
+      block();
+    }
+    if (pending_.load(std::memory_order_relaxed) & kWaiting) {
+      while (!released_.load(std::memory_order_acquire)) {
+        cpu_relax();
+      }
+      released_.store(false, std::memory_order_relaxed);
+      pending_.store(0, std::memory_order_relaxed);
+    }
+    if (failed_.load(std::memory_order_acquire)) {
+      failed_.store(false, std::memory_order_relaxed);
+      std::rethrow_exception(std::exchange(error_, nullptr));
+    }
+  }
+};
@@ -1,26 +1,52 @@
 #pragma once
 
+#include <algorithm>
 #include <atomic>
+#include <cassert>
+#include <chrono>
+#include <concepts>
 #include <condition_variable>
+#include <coroutine>
+#include <ctime>
 #include <deque>
+#include <exception>
 #include <functional>
+#include <memory>
 #include <mutex>
+#include <ranges>
 #include <thread>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
+#include "../ring-buffer/RingBuffer.h"
+#include "Future.h"
+#include "IdlePolicy.h"
+#include "Stats.h"
+#include "Task.h"
+#include "TimerWheel.h"
+#include "Topology.h"
+#include "WorkStealingDeque.h"
+
 // Implement a thread-safe queue using only a mutex and standard containers
 class BasicThreadSafeQueue {
-  std::deque<std::function<void()>> queue_;
+  std::deque<Task> queue_;
   std::mutex mutex_;
   bool done_{false};
+  // How often try-locking the queue failed
+  std::atomic<uint64_t> pushContended_{0};
+  std::atomic<uint64_t> popContended_{0};
 
  public:
-  bool pop(std::function<void()>& x) {
+  bool pop(Task& x) {
     // We try to acquire the lock without blocking. If we fail, we just return.
     // The caller needs to keep trying until the call succeeds.
     std::unique_lock<std::mutex> lock{mutex_, std::try_to_lock};
-    if (!lock || queue_.empty()) {
+    if (!lock) {
+      popContended_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    if (queue_.empty()) {
       return false;
     }
     x = std::move(queue_.front());
@@ -36,6 +62,7 @@ class BasicThreadSafeQueue {
     {
       std::unique_lock<std::mutex> lock{mutex_, std::try_to_lock};
       if (!lock) {
+        pushContended_.fetch_add(1, std::memory_order_relaxed);
         return false;
       }
       queue_.emplace_back(std::forward<F>(f));
@@ -53,38 +80,84 @@ class BasicThreadSafeQueue {
     std::unique_lock<std::mutex> lock{mutex_};
     return done_;
   }
+
+  bool empty() {
+    std::unique_lock<std::mutex> lock{mutex_};
+    return queue_.empty();
+  }
+
+  uint64_t push_contended() const {
+    return pushContended_.load(std::memory_order_relaxed);
+  }
+
+  uint64_t pop_contended() const {
+    return popContended_.load(std::memory_order_relaxed);
+  }
 };
 
 class BasicThreadPool {
-  const unsigned nthreads_{std::thread::hardware_concurrency()};
+  const unsigned nthreads_;
   std::vector<std::thread> threads_;
   BasicThreadSafeQueue queue_;
+  const IdlePolicy idle_;
+  EventCount events_;
+  std::vector<WorkerCounters> counters_{nthreads_};
 
-  void run() {
+  void run(unsigned i) {
+    auto& counters = counters_[i];
+    WorkerCounters::current = &counters;
+    Backoff backoff{idle_};
     while (true) {
-      std::function<void()> task;
+      Task task;
       if (queue_.is_done()) {
         break;
       }
-      // Block until we're able to pop a task
+      // Keep trying until we're able to pop a task, and go to sleep if it
+      // takes too long.
       if (!queue_.pop(task)) {
-        std::this_thread::yield();
+        counters.idle();
+        if (backoff.idle()) {
+          auto key = events_.prepare_wait();
+          if (!queue_.empty() || queue_.is_done()) {
+            events_.cancel_wait();
+          } else {
+            counters.parked();
+            events_.wait(key);
+            counters.unparked();
+          }
+        }
         continue;
       }
+      counters.busy();
+      backoff.reset();
       task();
+      counters.executed();
+    }
+  }
+
+  template <typename F>
+  void push(F&& f) {
+    // Block until we're able to push a task
+    while (!queue_.push(std::forward<F>(f))) {
+      std::this_thread::yield();
     }
   }
 
  public:
-  BasicThreadPool() {
+  explicit BasicThreadPool(IdlePolicy idle = {})
+      : BasicThreadPool(Topology::availableCpus(), idle) {}
+
+  explicit BasicThreadPool(unsigned nthreads, IdlePolicy idle = {})
+      : nthreads_(std::max(1u, nthreads)), idle_(idle) {
     threads_.reserve(nthreads_);
     for (unsigned i = 0; i != nthreads_; ++i) {
-      threads_.emplace_back([&]() { run(); });
+      threads_.emplace_back([&, i]() { run(i); });
     }
   }
 
   ~BasicThreadPool() {
     queue_.done();  // NOTE: Without this we hang in the dtor
+    events_.notify_all();
     for (auto& t : threads_) {
       t.join();
     }
@@ -92,22 +165,36 @@ class BasicThreadPool {
 
   template <typename F>
   void submit(F&& f) {
-    // Block until we're able to push a task
-    while (!queue_.push(std::forward<F>(f))) {
-      std::this_thread::yield();
+    if (WorkerCounters::sample<F>()) {
+      push(WorkerCounters::timed(std::forward<F>(f)));
+    } else {
+      push(std::forward<F>(f));
+    }
+    events_.notify_one();
+  }
+
+  unsigned size() const { return nthreads_; }
+
+  PoolStats stats() const {
+    PoolStats stats;
+    for (auto& c : counters_) {
+      stats.workers.push_back(c.snapshot());
     }
+    stats.push_contended = queue_.push_contended();
+    stats.pop_contended = queue_.pop_contended();
+    return stats;
   }
 };
 
 // Implement a thread-safe queue using a mutex and a condition variable
 class SimpleThreadSafeQueue {
-  std::deque<std::function<void()>> queue_;
+  std::deque<Task> queue_;
   std::mutex mutex_;
   std::condition_variable ready_;
   bool done_{false};
 
  public:
-  bool pop(std::function<void()>& x) {
+  bool pop(Task& x) {
     std::unique_lock<std::mutex> lock{mutex_};
     // NOTE: Without a 'done' function we wait here forever
     while (queue_.empty() && !done_) {
@@ -141,13 +228,16 @@ class SimpleThreadSafeQueue {
 
 // Implement a thread pool using the SimpleThreadSafeQueue
 class SimpleThreadPool {
-  const unsigned nthreads_{std::thread::hardware_concurrency()};
+  const unsigned nthreads_;
   std::vector<std::thread> threads_;
   SimpleThreadSafeQueue queue_;
+  // The queue blocks inside pop(), so only executed and wait are counted.
+  std::vector<WorkerCounters> counters_{nthreads_};
 
-  void run() {
+  void run(unsigned i) {
+    WorkerCounters::current = &counters_[i];
     while (true) {
-      std::function<void()> task;
+      Task task;
       // NOTE: Without this we crash. We pass an empty function to the pop
       // function, and since the queue is empty, this task never gets
       // initialized/populated. We then try to call it, and crash.
@@ -155,14 +245,16 @@ class SimpleThreadPool {
         break;
       }
       task();
+      counters_[i].executed();
     }
   }
 
  public:
-  SimpleThreadPool() {
+  explicit SimpleThreadPool(unsigned nthreads = Topology::availableCpus())
+      : nthreads_(std::max(1u, nthreads)) {
     threads_.reserve(nthreads_);
     for (unsigned i = 0; i != nthreads_; ++i) {
-      threads_.emplace_back([&]() { run(); });
+      threads_.emplace_back([&, i]() { run(i); });
     }
   }
 
@@ -175,39 +267,138 @@ class SimpleThreadPool {
 
   template <typename F>
   void submit(F&& f) {
-    queue_.push(std::forward<F>(f));
+    if (WorkerCounters::sample<F>()) {
+      queue_.push(WorkerCounters::timed(std::forward<F>(f)));
+    } else {
+      queue_.push(std::forward<F>(f));
+    }
+  }
+
+  unsigned size() const { return nthreads_; }
+
+  PoolStats stats() const {
+    PoolStats stats;
+    for (auto& c : counters_) {
+      stats.workers.push_back(c.snapshot());
+    }
+    return stats;
   }
 };
 
-// Implement a non-blocking thread-safe queue
+// Implement a non-blocking thread-safe queue. It's unbounded by default. With
+// a capacity, the tasks live in a fixed RingBuffer instead of a deque, so the
+// queue never allocates, and pushes fail once it's full. Producers and
+// consumers all hold the lock, which makes the single-producer ring safe to
+// share.
 class ThreadSafeQueue {
-  std::deque<std::function<void()>> queue_;
+  std::deque<Task> queue_;
+  std::unique_ptr<RingBuffer<Task>> ring_;
   std::mutex mutex_;
   std::condition_variable ready_;
   bool done_{false};
+  // Mirrors the number of queued tasks so that other threads can skip an
+  // empty queue without touching the mutex. Only written with the lock held.
+  std::atomic<size_t> size_{0};
+  // How often try-locking the queue failed
+  std::atomic<uint64_t> pushContended_{0};
+  std::atomic<uint64_t> popContended_{0};
+  // Tasks ever pushed. Only written with the lock held.
+  std::atomic<uint64_t> pushed_{0};
+
+  void resize(size_t n) { size_.store(n, std::memory_order_relaxed); }
+
+  // Must hold the lock. Fails if the queue is full.
+  template <typename F>
+  bool append(F&& f) {
+    const auto n = size_.load(std::memory_order_relaxed);
+    if (ring_) {
+      if (!ring_->push(std::forward<F>(f))) {
+        return false;
+      }
+    } else {
+      queue_.emplace_back(std::forward<F>(f));
+    }
+    resize(n + 1);
+    pushed_.store(pushed_.load(std::memory_order_relaxed) + 1,
+                  std::memory_order_relaxed);
+    return true;
+  }
+
+  // Must hold the lock, and the queue must not be empty.
+  void take(Task& x) {
+    if (ring_) {
+      ring_->pop(x);
+    } else {
+      x = std::move(queue_.front());
+      queue_.pop_front();
+    }
+    resize(size_.load(std::memory_order_relaxed) - 1);
+  }
 
  public:
-  bool try_pop(std::function<void()>& x) {
+  // Bounds the queue to 'capacity' tasks, 0 for no bound. Only before the
+  // queue is used.
+  void set_capacity(size_t capacity) {
+    assert(size_.load(std::memory_order_relaxed) == 0);
+    ring_.reset(capacity ? new RingBuffer<Task>(
+                               static_cast<uint32_t>(capacity + 1))
+                         : nullptr);
+  }
+
+  bool try_pop(Task& x) {
     // We try to acquire the lock without blocking. If we fail, we just return.
     // The caller needs to try to pop from a different queue or wait.
+    if (empty()) {
+      return false;
+    }
     std::unique_lock<std::mutex> lock{mutex_, std::try_to_lock};
-    if (!lock || queue_.empty()) {
+    if (!lock) {
+      popContended_.fetch_add(1, std::memory_order_relaxed);
       return false;
     }
-    x = std::move(queue_.front());
-    queue_.pop_front();
+    if (empty()) {
+      return false;
+    }
+    take(x);
+    return true;
+  }
+
+  bool try_pop_all(std::deque<Task>& xs) {
+    // Same idea as try_pop, but takes everything in one go.
+    if (empty()) {
+      return false;
+    }
+    std::unique_lock<std::mutex> lock{mutex_, std::try_to_lock};
+    if (!lock) {
+      popContended_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    if (empty()) {
+      return false;
+    }
+    if (ring_) {
+      while (!empty()) {
+        take(xs.emplace_back());
+      }
+    } else {
+      xs.swap(queue_);
+      resize(0);
+    }
     return true;
   }
 
   template <typename F>
   bool try_push(F&& f) {
-    // Same idea as try_pop.
+    // Same idea as try_pop. Also fails if the queue is full.
     {
       std::unique_lock<std::mutex> lock{mutex_, std::try_to_lock};
       if (!lock) {
+        pushContended_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      }
+      if (!append(std::forward<F>(f))) {
         return false;
       }
-      queue_.emplace_back(std::forward<F>(f));
     }
     ready_.notify_one();
     return true;
@@ -221,84 +412,888 @@ class ThreadSafeQueue {
     ready_.notify_all();
   }
 
-  bool pop(std::function<void()>& x) {
+  bool pop(Task& x) {
     // Block until we're able to pop a task. Used when we must pop a task from
     // this queue.
     std::unique_lock<std::mutex> lock{mutex_};
-    while (queue_.empty() && !done_) {
+    while (empty() && !done_) {
       ready_.wait(lock);
     }
-    if (queue_.empty()) {
+    if (empty()) {
       return false;
     }
-    x = std::move(queue_.front());
-    queue_.pop_front();
+    take(x);
     return true;
   }
 
   template <typename F>
-  void push(F&& f) {
-    // Same idea as pop.
+  bool push(F&& f) {
+    // Same idea as pop, except that we don't wait for room: this fails if the
+    // queue is full.
     {
       std::unique_lock<std::mutex> lock{mutex_};
-      queue_.emplace_back(std::forward<F>(f));
+      if (!append(std::forward<F>(f))) {
+        return false;
+      }
     }
     ready_.notify_one();
+    return true;
+  }
+
+  // Only hints, the queue may change right after we look at it.
+  bool empty() const { return size_.load(std::memory_order_relaxed) == 0; }
+  size_t size() const { return size_.load(std::memory_order_relaxed); }
+
+  // 0 if the queue is unbounded
+  size_t capacity() const { return ring_ ? ring_->capacity() : 0; }
+
+  // How many tasks were ever pushed, for counting what's still pending
+  uint64_t pushed_count() const {
+    return pushed_.load(std::memory_order_relaxed);
+  }
+
+  uint64_t push_contended() const {
+    return pushContended_.load(std::memory_order_relaxed);
+  }
+
+  uint64_t pop_contended() const {
+    return popContended_.load(std::memory_order_relaxed);
+  }
+};
+
+// Storage for the tasks sitting in a worker's deque. Only the owner takes
+// nodes out of the pool. A node released by another worker (because it stole
+// the task) goes back to the owner through a lock-free stack, which the owner
+// grabs as a whole whenever its local list runs dry. In steady state we never
+// allocate.
+class TaskNodePool {
+ public:
+  struct Node {
+    Task task;
+    Node* next{nullptr};
+    TaskNodePool* home{nullptr};
+    unsigned lane{0};
+  };
+
+ private:
+  static constexpr size_t kChunkSize = 64;
+
+  Node* local_{nullptr};
+  std::vector<std::unique_ptr<Node[]>> chunks_;
+  alignas(64) std::atomic<Node*> remote_{nullptr};
+
+ public:
+  // Owner only.
+  Node* allocate(Task&& task, unsigned lane) {
+    if (!local_) {
+      local_ = remote_.exchange(nullptr, std::memory_order_acquire);
+    }
+    if (!local_) {
+      chunks_.emplace_back(new Node[kChunkSize]);
+      auto* chunk = chunks_.back().get();
+      for (size_t n = 0; n != kChunkSize; ++n) {
+        chunk[n].home = this;
+        chunk[n].next = n + 1 != kChunkSize ? &chunk[n + 1] : nullptr;
+      }
+      local_ = chunk;
+    }
+    auto* node = local_;
+    local_ = node->next;
+    node->task = std::move(task);
+    node->lane = lane;
+    return node;
+  }
+
+  // Hands the node back to the pool it came from. 'current' is the pool owned
+  // by the calling thread.
+  static void release(Node* node, TaskNodePool& current) {
+    node->task = Task{};
+    auto* home = node->home;
+    if (home == &current) {
+      node->next = home->local_;
+      home->local_ = node;
+      return;
+    }
+    node->next = home->remote_.load(std::memory_order_relaxed);
+    while (!home->remote_.compare_exchange_weak(node->next, node,
+                                                std::memory_order_release,
+                                                std::memory_order_relaxed)) {
+    }
   }
 };
 
-// Implement a work-stealing thread pool
+// What submitting to a bounded ThreadPool does when its queues are full
+enum class Overflow {
+  kBlock,       // Wait for room
+  kCallerRuns,  // Run the task on the submitting thread
+};
+
+struct ThreadPoolOptions {
+  IdlePolicy idle;
+  // Number of priority lanes. Lane 0 has the highest priority, and workers
+  // always look for work in the higher lanes first.
+  unsigned priorities = 1;
+  // Every starvation_limit-th task a worker picks up is looked for from the
+  // lowest lane up, so that the low lanes always get a share of the pool.
+  unsigned starvation_limit = 16;
+  // Pin each worker to a CPU, and have workers steal from those that share
+  // the most with them first: SMT siblings, then the LLC, then the node.
+  bool pin = false;
+  // Number of workers the pool keeps, 0 for the number of CPUs we can use
+  // (which takes cgroup CPU quotas into account).
+  unsigned threads = 0;
+  // If more than 'threads', the pool starts extra workers, up to max_threads,
+  // when tasks pile up while no worker is idle.
+  unsigned max_threads = 0;
+  // How long an extra worker stays parked before it exits
+  std::chrono::milliseconds idle_timeout{1000};
+  // How many tasks each queue of a worker holds, 0 for no limit. This bounds
+  // what's submitted from outside the pool: the tasks that workers submit go
+  // to their own deques, which have no limit.
+  size_t queue_capacity = 0;
+  // What submit() does when the queues are full. try_submit() returns false
+  // instead.
+  Overflow overflow = Overflow::kBlock;
+};
+
+// Implement a work-stealing thread pool. Each worker owns a lock-free
+// Chase-Lev deque. Tasks submitted from outside land in the worker's
+// ThreadSafeQueue first, and the worker moves them over to its deque in
+// batches, where the other workers can steal them without taking any lock.
+// With more than one priority, every worker has a queue and a deque per lane.
 class ThreadPool {
-  const unsigned nthreads_{std::thread::hardware_concurrency()};
-  std::vector<std::thread> threads_;
-  std::vector<ThreadSafeQueue> queues_{nthreads_};
+  friend class Strand;
+  friend class TaskGroup;
+
+  using Node = TaskNodePool::Node;
+
+  struct Lane {
+    ThreadSafeQueue queue;
+    WorkStealingDeque<Node*> deque;
+  };
+
+  struct alignas(64) Worker {
+    std::unique_ptr<Lane[]> lanes;
+    TaskNodePool nodes;
+    std::deque<Task> batch;
+    unsigned picks{0};
+    // The other workers, in the order we steal from them
+    std::vector<unsigned> victims;
+    WorkerCounters counters;
+    // Whether a thread is running this worker
+    std::atomic<bool> running{false};
+  };
+
+  // A submission that finds this many tasks in the queue it lands in, while
+  // no worker is idle, starts another worker (if there is room for one).
+  static constexpr size_t kGrowBacklog = 64;
+
+  // Worker slots. They all exist from the start, whether a thread runs them
+  // or not, so that the others can always steal from any of them.
+  const unsigned nthreads_;
+  std::vector<std::thread> threads_{nthreads_};
+  std::vector<Worker> workers_{nthreads_};
   std::atomic<unsigned> index_{0};
-  const unsigned KMaxIterations = 32;
+  const ThreadPoolOptions options_;
+  const Topology topology_;
+  // Where idle workers sleep. Anything that makes work available wakes up
+  // one of them.
+  EventCount events_;
+  // Where wait_idle() sleeps. Workers poke it when they run out of work.
+  EventCount quiet_;
+  // Where submitters wait for room in bounded queues
+  EventCount space_;
+  std::atomic<bool> done_{false};
+  // How many workers are running, and how many of them we keep when idle
+  std::atomic<unsigned> live_{0};
+  std::atomic<unsigned> floor_;
+  // Held while starting workers
+  std::mutex resize_;
+  // Blocks for future states, and for the nodes of Strand's queues
+  FutureSlab futures_;
+  // Runs submit_after() and submit_every(). Started by the first of them.
+  std::once_flag timersStarted_;
+  std::unique_ptr<TimerService> timers_;
+  // Set once timers_ exists, for cancel() to check without starting it
+  std::atomic<bool> hasTimers_{false};
+
+  // Which pool and worker the current thread belongs to, if any
+  static inline thread_local ThreadPool* currentPool_ = nullptr;
+  static inline thread_local unsigned currentWorker_ = 0;
+  // Lane of the task the current worker is running
+  static inline thread_local unsigned currentLane_ = 0;
+
+  // State shared by the pieces of a bulk submission
+  template <typename It, typename F>
+  struct Bulk {
+    It first;
+    size_t grain;
+    F fn;
+    std::atomic<size_t> remaining;
+    Promise<void> promise;
+    std::atomic<bool> failed{false};
+    std::exception_ptr error;
+
+    Bulk(It first, size_t n, size_t grain, F fn, Promise<void> promise)
+        : first(first),
+          grain(std::max<size_t>(grain, 1)),
+          fn(std::move(fn)),
+          remaining(n),
+          promise(std::move(promise)) {}
+  };
+
+  // Moves everything queued in the victim's queue to our own deque.
+  bool refill(Worker& w, Worker& victim, unsigned p) {
+    if (!victim.lanes[p].queue.try_pop_all(w.batch)) {
+      return false;
+    }
+    if (options_.queue_capacity) {
+      space_.notify_all();
+    }
+    for (; !w.batch.empty(); w.batch.pop_front()) {
+      w.lanes[p].deque.push(w.nodes.allocate(std::move(w.batch.front()), p));
+    }
+    return true;
+  }
+
+  // Looks for a task in lane p. Sets 'missed' if we saw a task there but lost
+  // it to another thread, or couldn't take a lock to get to it.
+  bool try_get(unsigned i, unsigned p, Node*& f, bool& missed) {
+    auto& w = workers_[i];
+    auto& lane = w.lanes[p];
+    // Our own deque first, newest task first, since it is the most likely to
+    // still be in the cache.
+    if (lane.deque.pop(f) || (refill(w, w, p) && lane.deque.pop(f))) {
+      w.counters.localPop();
+      return true;
+    }
+    // Then steal the oldest task from someone else's deque...
+    for (auto v : w.victims) {
+      auto& victim = workers_[v].lanes[p];
+      if (victim.deque.empty()) {
+        continue;
+      }
+      const bool stolen = victim.deque.steal(f);
+      w.counters.stealAttempt(stolen);
+      if (stolen) {
+        return true;
+      }
+      missed |= !victim.deque.empty();
+    }
+    // ...or grab whatever is waiting in someone else's queue.
+    for (auto v : w.victims) {
+      auto& victim = workers_[v];
+      if (victim.lanes[p].queue.empty()) {
+        continue;
+      }
+      const bool stolen = refill(w, victim, p) && lane.deque.pop(f);
+      w.counters.stealAttempt(stolen);
+      if (stolen) {
+        return true;
+      }
+      missed |= !victim.lanes[p].queue.empty();
+    }
+    missed |= !lane.queue.empty();
+    return false;
+  }
+
+  // Looks for a task in every lane, from the highest priority down, except
+  // that every now and then we start from the bottom. We only move on to the
+  // next lane once the current one looks empty.
+  bool try_get(unsigned i, Node*& f) {
+    auto& w = workers_[i];
+    const auto lanes = options_.priorities;
+    const bool starving = lanes > 1 && options_.starvation_limit != 0 &&
+                          w.picks % options_.starvation_limit ==
+                              options_.starvation_limit - 1;
+    for (unsigned k = 0; k != lanes; ++k) {
+      const auto p = starving ? lanes - 1 - k : k;
+      bool missed;
+      do {
+        missed = false;
+        if (try_get(i, p, f, missed)) {
+          ++w.picks;
+          return true;
+        }
+      } while (missed && lanes > 1);
+    }
+    return false;
+  }
+
+  // Tasks must not throw. There's no one to hand the exception to: not the
+  // worker loop, and not a waiter that happens to run the task while it
+  // helps, since the task isn't theirs. So a task that throws ends the
+  // program, wherever it runs, as it would on a std::thread. use_future,
+  // TaskGroup and the bulk calls catch exceptions and pass them on instead.
+  void execute(Worker& w, Node* f) noexcept {
+    currentLane_ = f->lane;
+    f->task();
+    TaskNodePool::release(f, w.nodes);
+    w.counters.executed();
+  }
+
+  // Runs tasks until done() returns true, so that a worker waiting on work it
+  // spawned itself doesn't tie up a thread (or deadlock a small pool). Must
+  // be called from one of our workers.
+  template <std::predicate Done>
+  void helpUntil(Done&& done) {
+    // The tasks we run set the lane to theirs. Put back the waiting task's
+    // however we leave.
+    struct RestoreLane {
+      unsigned lane = currentLane_;
+      ~RestoreLane() { currentLane_ = lane; }
+    } restore;
+    auto& w = workers_[currentWorker_];
+    while (!done()) {
+      Node* f = nullptr;
+      if (try_get(currentWorker_, f)) {
+        execute(w, f);
+      } else {
+        std::this_thread::yield();
+      }
+    }
+  }
+
+  // Same as above, but from anywhere: outside the pool, we just wait.
+  void helpUntil(const Future<void>& future) {
+    if (currentPool_ != this) {
+      future.wait();
+      return;
+    }
+    helpUntil([&] { return future.ready(); });
+  }
+
+  // Pushes the task to the current worker's deque, in lane p. No lock and no
+  // shared counter: only the worker itself pushes there. Must be called from
+  // one of our workers.
+  void spawn(unsigned p, Task&& task) {
+    assert(currentPool_ == this);
+    auto& w = workers_[currentWorker_];
+    w.counters.spawned();
+    w.lanes[p].deque.push(w.nodes.allocate(std::move(task), p));
+    events_.notify_one();
+  }
+
+  // Returns the queue the task went to, or null if the pool is bounded and
+  // all the queues of lane p are full.
+  template <typename F>
+  ThreadSafeQueue* push(unsigned p, F&& f) {
+    auto i = index_++;
+    // Try to push to any queue that is not blocked, of a running worker. The
+    // queues of the others are fine too, just slower to get to.
+    for (unsigned n = 0; n != nthreads_; ++n) {
+      auto& w = workers_[(i + n) % nthreads_];
+      if (w.running.load(std::memory_order_relaxed) &&
+          w.lanes[p].queue.try_push(std::forward<F>(f))) {
+        return &w.lanes[p].queue;
+      }
+    }
+    // If we couldn't push to any queue, push to our own queue.
+    auto& queue = workers_[i % nthreads_].lanes[p].queue;
+    if (queue.push(std::forward<F>(f))) {
+      return &queue;
+    }
+    // It's bounded and full, try the others (those locked or full before).
+    for (unsigned n = 1; n != nthreads_; ++n) {
+      auto& other = workers_[(i + n) % nthreads_].lanes[p].queue;
+      if (other.push(std::forward<F>(f))) {
+        return &other;
+      }
+    }
+    return nullptr;
+  }
+
+  // What to do with a task from outside the pool when the queues are full
+  enum class Full {
+    kWait,
+    kRun,  // Right away, on the submitting thread
+    kFail,
+  };
+
+  // Hands a task from outside the pool over to the workers. Returns false if
+  // the queues were full, and 'full' is kFail.
+  template <typename F>
+  bool inject(unsigned p, F&& f, Full full) {
+    auto* queue = push(p, std::forward<F>(f));
+    while (!queue) {
+      // Pushing only takes f if it succeeds, so we still have it here.
+      if (full == Full::kRun) {
+        f();
+        return true;
+      }
+      if (full == Full::kFail) {
+        return false;
+      }
+      auto key = space_.prepare_wait();
+      queue = push(p, std::forward<F>(f));
+      if (queue) {
+        space_.cancel_wait();
+      } else {
+        space_.wait(key);
+      }
+    }
+    events_.notify_one();
+    if (queue->size() >= kGrowBacklog && events_.waiters() == 0 &&
+        live_.load(std::memory_order_relaxed) < nthreads_) {
+      // Everybody is busy and tasks are piling up.
+      std::unique_lock<std::mutex> lock{resize_, std::try_to_lock};
+      if (lock) {
+        grow(live_.load(std::memory_order_relaxed) + 1);
+      }
+    }
+    return true;
+  }
+
+  // Submits f in lane p, sampling its wait time now and then.
+  template <typename F>
+  bool submit(unsigned p, F&& f, Full full) {
+    assert(p < options_.priorities);
+    if (currentPool_ == this) {
+      if (WorkerCounters::sample<F>()) {
+        spawn(p, WorkerCounters::timed(std::forward<F>(f)));
+      } else {
+        spawn(p, std::forward<F>(f));
+      }
+      return true;
+    }
+    // Timing f would move it into the wrapper, so try_submit doesn't sample:
+    // it leaves f with the caller when it fails.
+    return full != Full::kFail && WorkerCounters::sample<F>()
+               ? inject(p, WorkerCounters::timed(std::forward<F>(f)), full)
+               : inject(p, std::forward<F>(f), full);
+  }
+
+  TimerService& timers() {
+    std::call_once(timersStarted_, [this] {
+      // Expired timers come in batches, spread them over the queues. If the
+      // pool is bounded and full, the timers wait for room.
+      timers_ = std::make_unique<TimerService>([this](std::vector<Task>& ts) {
+        for (auto& t : ts) {
+          inject(0, std::move(t), Full::kWait);
+        }
+      });
+      hasTimers_.store(true, std::memory_order_release);
+    });
+    return *timers_;
+  }
+
+  static unsigned threadsFor(const ThreadPoolOptions& options) {
+    return options.threads ? options.threads : Topology::availableCpus();
+  }
+
+  // Starts a thread for the worker in slot i. Must hold resize_.
+  void start(unsigned i) {
+    if (threads_[i].joinable()) {
+      // A worker that retired
+      threads_[i].join();
+    }
+    workers_[i].running.store(true, std::memory_order_relaxed);
+    live_.fetch_add(1, std::memory_order_relaxed);
+    threads_[i] = std::thread([this, i] { run(i); });
+  }
+
+  // Starts workers in free slots until n are running. Must hold resize_.
+  void grow(unsigned n) {
+    for (unsigned i = 0; i != nthreads_; ++i) {
+      if (live_.load(std::memory_order_relaxed) >= n ||
+          done_.load(std::memory_order_relaxed)) {
+        return;
+      }
+      if (!workers_[i].running.load(std::memory_order_acquire)) {
+        start(i);
+      }
+    }
+  }
+
+  // An idle worker calls this to exit, which it may only do while there are
+  // more workers than we keep.
+  bool retire() {
+    auto n = live_.load(std::memory_order_relaxed);
+    while (n > floor_.load(std::memory_order_relaxed)) {
+      if (live_.compare_exchange_weak(n, n - 1, std::memory_order_relaxed)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Whether every task submitted so far has run. We add up the tasks that
+  // ran before the ones that were submitted: since a task runs after it's
+  // submitted, the totals can only match if at some point in between there
+  // was nothing left to run.
+  bool idle() const {
+    uint64_t executed = 0;
+    for (auto& w : workers_) {
+      executed += w.counters.snapshot().executed;
+    }
+    uint64_t submitted = 0;
+    for (auto& w : workers_) {
+      submitted += w.counters.snapshot().spawned;
+      for (unsigned p = 0; p != options_.priorities; ++p) {
+        submitted += w.lanes[p].queue.pushed_count();
+      }
+    }
+    return executed == submitted;
+  }
+
+  // Whether there's any task left anywhere in the pool. Only used at
+  // shutdown, when no one else adds tasks except our own workers.
+  bool drained() const {
+    for (auto& w : workers_) {
+      for (unsigned p = 0; p != options_.priorities; ++p) {
+        if (!w.lanes[p].queue.empty() || !w.lanes[p].deque.empty()) {
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+
+  template <typename It>
+  static decltype(auto) at(It first, size_t i) {
+    if constexpr (std::is_integral_v<It>) {
+      return static_cast<It>(first + i);
+    } else {
+      return first[i];
+    }
+  }
+
+  // Runs [lo, hi) of a bulk submission grain by grain. Before each grain, if
+  // our deque is empty (so there's nothing for the other workers to steal
+  // from us), we split off the upper half of what's left and push it. This is
+  // lazy binary splitting: we only pay for a push when someone may be idle.
+  // A piece that a full bounded pool hands back to the submitting thread
+  // (Overflow::kCallerRuns) runs there whole: only a worker may push to its
+  // deque, and the queues had no room anyway.
+  template <typename B>
+  void runRange(B* bulk, size_t lo, size_t hi) {
+    const bool split = currentPool_ == this;
+    size_t done = 0;
+    while (lo != hi) {
+      if (split && hi - lo > bulk->grain &&
+          workers_[currentWorker_].lanes[currentLane_].deque.empty()) {
+        const auto mid = lo + (hi - lo) / 2;
+        spawn(currentLane_, [this, bulk, mid, hi] { runRange(bulk, mid, hi); });
+        hi = mid;
+        continue;
+      }
+      const auto end = std::min(hi, lo + bulk->grain);
+      if (!bulk->failed.load(std::memory_order_relaxed)) {
+        try {
+          for (auto i = lo; i != end; ++i) {
+            std::invoke(bulk->fn, at(bulk->first, i));
+          }
+        } catch (...) {
+          if (!bulk->failed.exchange(true)) {
+            bulk->error = std::current_exception();
+          }
+        }
+      }
+      done += end - lo;
+      lo = end;
+    }
+    if (bulk->remaining.fetch_sub(done, std::memory_order_acq_rel) == done) {
+      if (bulk->error) {
+        bulk->promise.set_exception(bulk->error);
+      } else {
+        bulk->promise.set_value();
+      }
+      delete bulk;
+    }
+  }
+
+  // Splits [0, n) into one piece per worker and lets the workers split those
+  // further as they need.
+  template <typename It, typename F>
+  Future<void> bulk(It first, size_t n, size_t grain, F&& fn) {
+    auto [future, promise] = make_future<void>();
+    if (n == 0) {
+      promise.set_value();
+      return std::move(future);
+    }
+    using B = Bulk<It, std::decay_t<F>>;
+    auto* b = new B(first, n, grain, std::forward<F>(fn), std::move(promise));
+    const size_t pieces =
+        std::min<size_t>(size(), (n + b->grain - 1) / b->grain);
+    for (size_t k = 0; k != pieces; ++k) {
+      const auto lo = n * k / pieces;
+      const auto hi = n * (k + 1) / pieces;
+      submit([this, b, lo, hi] { runRange(b, lo, hi); });
+    }
+    return std::move(future);
+  }
 
   void run(unsigned i) {
+    currentPool_ = this;
+    currentWorker_ = i;
+    if (options_.pin) {
+      topology_.pin(i);
+    }
+    auto& w = workers_[i];
+    WorkerCounters::current = &w.counters;
+    Backoff backoff{options_.idle};
+    const auto ms = options_.idle_timeout.count();
+    const timespec timeout{static_cast<time_t>(ms / 1000),
+                           static_cast<long>(ms % 1000 * 1000000)};
     while (true) {
-      std::function<void()> f;
-      // Try to pop from any queue that has tasks available.
-      for (unsigned n = 0; n != nthreads_ * KMaxIterations; ++n) {
-        if (queues_[(i + n) % nthreads_].try_pop(f)) {
-          break;
-        }
+      Node* f = nullptr;
+      // Try to find a task anywhere in the pool.
+      if (try_get(i, f)) {
+        w.counters.busy();
+        backoff.reset();
+        execute(w, f);
+        continue;
+      }
+      w.counters.idle();
+      if (!backoff.idle()) {
+        continue;
+      }
+      // We've been looking for a while, go to sleep. Our deque is empty at
+      // this point, so there's nothing left behind for the others to steal.
+      auto key = events_.prepare_wait();
+      if (try_get(i, f)) {
+        events_.cancel_wait();
+        w.counters.busy();
+        backoff.reset();
+        execute(w, f);
+        continue;
       }
-      // If we didn't find a task, try to pop from our own queue.
-      if (!f && !queues_[i].pop(f)) {
+      if (done_.load(std::memory_order_acquire) && drained()) {
+        events_.cancel_wait();
+        break;
+      }
+      // Workers beyond the ones we keep only wait for so long.
+      const bool spare = live_.load(std::memory_order_relaxed) >
+                         floor_.load(std::memory_order_relaxed);
+      w.counters.parked();
+      quiet_.notify_all();
+      const bool notified = events_.wait(key, spare ? &timeout : nullptr);
+      w.counters.unparked();
+      if (!notified && retire()) {
+        // Anything that lands in our queues from now on gets stolen.
         break;
       }
-      f();
     }
+    w.running.store(false, std::memory_order_release);
   }
 
  public:
-  ThreadPool() {
-    threads_.reserve(nthreads_);
+  explicit ThreadPool(ThreadPoolOptions options = {})
+      : nthreads_(std::max({1u, threadsFor(options), options.max_threads})),
+        options_(options),
+        topology_(options.pin ? Topology::detect()
+                              : Topology::uniform(nthreads_)),
+        floor_(threadsFor(options)) {
+    assert(options_.priorities > 0);
     for (unsigned n = 0; n != nthreads_; ++n) {
-      threads_.emplace_back([&, n] { run(n); });
+      workers_[n].lanes.reset(new Lane[options_.priorities]);
+      for (unsigned p = 0; p != options_.priorities; ++p) {
+        workers_[n].lanes[p].queue.set_capacity(options_.queue_capacity);
+      }
+      workers_[n].victims = topology_.victims(n, nthreads_);
     }
+    std::lock_guard<std::mutex> lock{resize_};
+    grow(floor_);
   }
 
+  explicit ThreadPool(unsigned threads)
+      : ThreadPool([threads] {
+          ThreadPoolOptions options;
+          options.threads = threads;
+          return options;
+        }()) {}
+
   ~ThreadPool() {
-    for (auto& e : queues_) {
-      e.done();
-    }
+    // Stop the timers first, so that nothing gets submitted while we wind
+    // down.
+    timers_.reset();
+    done_.store(true, std::memory_order_release);
+    events_.notify_all();
+    std::lock_guard<std::mutex> lock{resize_};
     for (auto& e : threads_) {
-      e.join();
+      if (e.joinable()) {
+        e.join();
+      }
     }
   }
 
+  // Runs f on one of the workers. From outside the pool, f goes to lane 0.
+  // From one of our own workers, it goes to the lane of the task that is
+  // running, straight into the worker's own deque. f must not throw: if it
+  // may, submit it with use_future, or run it in a TaskGroup.
   template <typename F>
   void submit(F&& f) {
-    auto i = index_++;
-    // Try to push to any queue that is not blocked.
-    for (unsigned n = 0; n != nthreads_; ++n) {
-      if (queues_[(i + n) % nthreads_].try_push(std::forward<F>(f))) {
+    submit(currentPool_ == this ? currentLane_ : 0, std::forward<F>(f));
+  }
+
+  // Same as above, in lane 'priority'. Lane 0 has the highest priority. If
+  // the pool is bounded and its queues are full, this waits for room, or runs
+  // f right here, depending on options.overflow.
+  template <typename F>
+  void submit(unsigned priority, F&& f) {
+    submit(priority, std::forward<F>(f),
+           options_.overflow == Overflow::kBlock ? Full::kWait : Full::kRun);
+  }
+
+  // Same as submit(), but returns false instead, if the queues are full. The
+  // task is only built from f once it has a place in a queue, so f is then
+  // left untouched with the caller.
+  template <typename F>
+  bool try_submit(F&& f) {
+    return submit(currentPool_ == this ? currentLane_ : 0, std::forward<F>(f),
+                  Full::kFail);
+  }
+
+  template <typename F>
+  bool try_submit(unsigned priority, F&& f) {
+    return submit(priority, std::forward<F>(f), Full::kFail);
+  }
+
+  // Runs f on one of the workers, in lane 0, once 'delay' has passed. Timers
+  // live in a timer wheel, so there can be lots of them pending, and they
+  // are cheap to cancel. They have a resolution of a millisecond, and never
+  // fire early.
+  template <typename Rep, typename Period, typename F>
+  TimerId submit_after(std::chrono::duration<Rep, Period> delay, F&& f) {
+    return timers().add(
+        std::chrono::duration_cast<std::chrono::steady_clock::duration>(delay),
+        Task(std::forward<F>(f)));
+  }
+
+  // Runs f every 'period', starting one period from now, until cancelled.
+  // Runs don't wait for each other: if f takes longer than the period, the
+  // next run may start before the last one is done. The period must be
+  // positive.
+  template <typename Rep, typename Period, typename F>
+  TimerId submit_every(std::chrono::duration<Rep, Period> period, F&& f) {
+    const auto p =
+        std::chrono::duration_cast<std::chrono::steady_clock::duration>(period);
+    assert(p > std::chrono::steady_clock::duration::zero());
+    return timers().add(p, Task(std::forward<F>(f)), p);
+  }
+
+  // Cancels a timer from submit_after() or submit_every(). Returns false if
+  // it was already cancelled, or it has already been handed to a worker (for
+  // the last time).
+  bool cancel(TimerId id) {
+    // Without a timer thread, no timer was ever scheduled.
+    if (!hasTimers_.load(std::memory_order_acquire)) {
+      return false;
+    }
+    return timers_->cancel(id);
+  }
+
+  // Blocks until every task submitted so far has run, along with everything
+  // they submitted in turn. Timers that haven't fired yet don't count. Tasks
+  // that other threads submit meanwhile do, so this may wait for a while if
+  // they keep at it. Not for use from a task on this pool, which would wait
+  // for itself: use a TaskGroup there.
+  void wait_idle() {
+    assert(currentPool_ != this);
+    // Workers that spin instead of parking don't tell us when they're done.
+    const timespec poll{0, 1000000};
+    while (true) {
+      auto key = quiet_.prepare_wait();
+      if (idle()) {
+        quiet_.cancel_wait();
         return;
       }
+      quiet_.wait(key, &poll);
     }
-    // If we couldn't push to any queue, push to our own queue.
-    queues_[i % nthreads_].push(std::forward<F>(f));
+  }
+
+  unsigned priorities() const { return options_.priorities; }
+
+  // Number of running workers
+  unsigned size() const { return live_.load(std::memory_order_relaxed); }
+
+  // Most workers the pool may run at once
+  unsigned capacity() const { return nthreads_; }
+
+  // Sets how many workers the pool keeps, up to capacity(). Growing starts
+  // them right away, shrinking lets the extra ones exit once they have been
+  // idle for options.idle_timeout.
+  void resize(unsigned n) {
+    floor_.store(std::clamp(n, 1u, nthreads_), std::memory_order_relaxed);
+    {
+      std::lock_guard<std::mutex> lock{resize_};
+      grow(floor_);
+    }
+    // Parked workers go back to sleep with a timeout if they are now extra.
+    events_.notify_all();
+  }
+
+  // A snapshot of the workers' counters. They keep running while we read, so
+  // the numbers are only roughly consistent with each other.
+  PoolStats stats() const {
+    PoolStats stats;
+    for (auto& w : workers_) {
+      stats.workers.push_back(w.counters.snapshot());
+      for (unsigned p = 0; p != options_.priorities; ++p) {
+        stats.push_contended += w.lanes[p].queue.push_contended();
+        stats.pop_contended += w.lanes[p].queue.pop_contended();
+      }
+    }
+    return stats;
+  }
+
+  // co_await pool.schedule() suspends the calling coroutine and resumes it on
+  // one of the workers, in lane 'priority'.
+  auto schedule(unsigned priority = 0) {
+    struct Awaiter {
+      ThreadPool* pool;
+      unsigned priority;
+
+      bool await_ready() const noexcept { return false; }
+      void await_suspend(std::coroutine_handle<> h) {
+        pool->submit(priority, [h] { h.resume(); });
+      }
+      void await_resume() const noexcept {}
+    };
+    return Awaiter{this, priority};
+  }
+
+  // A future/promise pair whose state comes from this pool, for things built
+  // on top of the pool that complete their own futures.
+  template <typename T>
+  std::pair<Future<T>, Promise<T>> make_future() {
+    return Promise<T>::create(futures_);
+  }
+
+  // Same as above, but hands back whatever f returns (or throws) through a
+  // Future, e.g., pool.submit(use_future, [] { return 42; }).get().
+  template <typename F, typename R = std::invoke_result_t<std::decay_t<F>&>>
+  Future<R> submit(UseFuture, F&& f) {
+    auto [future, promise] = make_future<R>();
+    submit([promise = std::move(promise), f = std::forward<F>(f)]() mutable {
+      promise.run(f);
+    });
+    return std::move(future);
+  }
+
+  // Calls fn(x) for each x in [first, last), where x is either an integer or
+  // what an iterator points to. Returns right away, the future tells when all
+  // calls are done (and carries the first exception thrown by any of them).
+  template <typename It, typename F>
+  Future<void> submit_bulk(It first, It last, F&& fn) {
+    const auto n = static_cast<size_t>(last - first);
+    const size_t grain = std::max<size_t>(1, n / (8 * size()));
+    return bulk(first, n, grain, std::forward<F>(fn));
+  }
+
+  // Calls fn(x) for each x in range, in pieces of at least grain elements,
+  // and returns when they are all done. For example:
+  //
+  //   pool.parallel_for(std::views::iota(0, n), 1024, [&](int i) { ... });
+  //
+  // When called from one of our workers, that worker keeps running tasks
+  // while it waits.
+  template <std::ranges::random_access_range R, typename F>
+  void parallel_for(R&& range, size_t grain, F&& fn) {
+    auto first = std::ranges::begin(range);
+    const auto n = static_cast<size_t>(std::ranges::distance(range));
+    auto done = bulk(first, n, grain, std::ref(fn));
+    helpUntil(done);
+    done.get();
   }
 };
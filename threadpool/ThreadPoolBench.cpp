@@ -1,6 +1,9 @@
+#include <algorithm>
 #include <atomic>
 #include <chrono>
 #include <future>
+#include <memory>
+#include <mutex>
 #include <numeric>
 #include <random>
 #include <thread>
@@ -8,8 +11,77 @@
 
 #include <benchmark/benchmark.h>
 
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include "ParallelAlgorithms.h"
+#include "Strand.h"
+#include "TaskGroup.h"
 #include "ThreadPool.h"
 
+// Adds the pool's counters to the benchmark's output, per iteration, so that
+// a slow run shows whether the time went to steals, lock contention or the
+// workers sleeping.
+static void ReportStats(benchmark::State& state, const PoolStats& stats) {
+    const auto total = stats.total();
+    const auto perIteration = benchmark::Counter::kAvgIterations;
+    state.counters["steals"] = benchmark::Counter(total.steals, perIteration);
+    state.counters["steal_tries"] =
+        benchmark::Counter(total.steal_attempts, perIteration);
+    state.counters["contended"] = benchmark::Counter(
+        stats.push_contended + stats.pop_contended, perIteration);
+    state.counters["parks"] = benchmark::Counter(total.parks, perIteration);
+    state.counters["idle_ms"] =
+        benchmark::Counter(total.idle_ns / 1e6, perIteration);
+    state.counters["wait_p50_ns"] = total.waitPercentile(0.5);
+    state.counters["wait_p99_ns"] = total.waitPercentile(0.99);
+}
+
+using Clock = std::chrono::steady_clock;
+
+static double Seconds(Clock::duration d) {
+    return std::chrono::duration<double>(d).count();
+}
+
+static double Nanoseconds(Clock::duration d) {
+    return std::chrono::duration<double, std::nano>(d).count();
+}
+
+// The q-th quantile (0 <= q <= 1) of the samples, which it sorts
+static double Percentile(std::vector<double>& samples, double q) {
+    if (samples.empty()) {
+        return 0;
+    }
+    const auto k = std::min(samples.size() - 1,
+                            static_cast<size_t>(q * samples.size()));
+    std::nth_element(samples.begin(), samples.begin() + k, samples.end());
+    return samples[k];
+}
+
+static void ReportPercentiles(benchmark::State& state,
+                              std::vector<double>& samples) {
+    state.counters["p50_ns"] = Percentile(samples, 0.5);
+    state.counters["p99_ns"] = Percentile(samples, 0.99);
+    state.counters["p999_ns"] = Percentile(samples, 0.999);
+    state.counters["max_ns"] = Percentile(samples, 1);
+}
+
+// For the pools that have no way to wait for their tasks
+static void WaitFor(const std::atomic<size_t>& counter, size_t n) {
+    while (counter.load(std::memory_order_acquire) < n) {
+        std::this_thread::yield();
+    }
+}
+
+// Burns about n units of CPU time
+static void Spin(size_t n) {
+    size_t x = 0;
+    for (size_t i = 0; i < n; ++i) {
+        benchmark::DoNotOptimize(x += i);
+    }
+}
+
 template<typename PoolType>
 static void BM_TaskThroughput(benchmark::State& state) {
     PoolType pool;
@@ -17,7 +89,7 @@ static void BM_TaskThroughput(benchmark::State& state) {
 
     for (auto _ : state) {
         counter = 0;
-        auto start = std::chrono::high_resolution_clock::now();
+        auto start = Clock::now();
 
         for (int i = 0; i < state.range(0); ++i) {
             pool.submit([&counter]() {
@@ -26,29 +98,549 @@ static void BM_TaskThroughput(benchmark::State& state) {
         }
 
         // Wait for all tasks to complete
-        while (counter < static_cast<size_t>(state.range(0))) {
+        if constexpr (requires { pool.wait_idle(); }) {
+            pool.wait_idle();
+        } else {
+            while (counter < static_cast<size_t>(state.range(0))) {
+                std::this_thread::yield();
+            }
+        }
+
+        state.SetIterationTime(Seconds(Clock::now() - start));
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    ReportStats(state, pool.stats());
+}
+
+// The same tasks, without a pool: a std::async or a std::thread each
+static void BM_AsyncThroughput(benchmark::State& state) {
+    std::atomic<size_t> counter{0};
+    std::vector<std::future<void>> futures(state.range(0));
+
+    for (auto _ : state) {
+        auto start = Clock::now();
+        for (auto& f : futures) {
+            f = std::async(std::launch::async, [&counter]() {
+                counter.fetch_add(1, std::memory_order_relaxed);
+            });
+        }
+        for (auto& f : futures) {
+            f.get();
+        }
+        state.SetIterationTime(Seconds(Clock::now() - start));
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+static void BM_ThreadThroughput(benchmark::State& state) {
+    std::atomic<size_t> counter{0};
+    std::vector<std::thread> threads(state.range(0));
+
+    for (auto _ : state) {
+        auto start = Clock::now();
+        for (auto& t : threads) {
+            t = std::thread([&counter]() {
+                counter.fetch_add(1, std::memory_order_relaxed);
+            });
+        }
+        for (auto& t : threads) {
+            t.join();
+        }
+        state.SetIterationTime(Seconds(Clock::now() - start));
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// Time from submit() to the task starting, for a steady stream of tasks from
+// one producer.
+template<typename PoolType>
+static void BM_SubmitLatency(benchmark::State& state) {
+    PoolType pool;
+    const size_t n = state.range(0);
+    std::vector<double> latencies(n);
+    std::vector<double> samples;
+    std::atomic<size_t> counter{0};
+
+    for (auto _ : state) {
+        counter = 0;
+        auto start = Clock::now();
+        for (size_t i = 0; i < n; ++i) {
+            pool.submit([&, i, submitted = Clock::now()]() {
+                latencies[i] = Nanoseconds(Clock::now() - submitted);
+                counter.fetch_add(1, std::memory_order_release);
+            });
+        }
+        WaitFor(counter, n);
+        state.SetIterationTime(Seconds(Clock::now() - start));
+        samples.insert(samples.end(), latencies.begin(), latencies.end());
+    }
+    state.SetItemsProcessed(state.iterations() * n);
+    ReportPercentiles(state, samples);
+}
+
+// Time for a parked pool to pick up a task: every iteration lets the
+// workers go to sleep, then submits one task.
+template<typename PoolType>
+static void BM_WakeLatency(benchmark::State& state) {
+    PoolType pool;
+    std::vector<double> samples;
+    std::atomic<bool> ran{false};
+
+    for (auto _ : state) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        ran = false;
+        Clock::time_point started;
+        auto start = Clock::now();
+        pool.submit([&]() {
+            started = Clock::now();
+            ran.store(true, std::memory_order_release);
+        });
+        while (!ran.load(std::memory_order_acquire)) {
+            std::this_thread::yield();
+        }
+        state.SetIterationTime(Seconds(Clock::now() - start));
+        samples.push_back(Nanoseconds(started - start));
+    }
+    ReportPercentiles(state, samples);
+}
+
+// Several threads submitting at once, all the tasks in total
+template<typename PoolType>
+static void BM_MultiProducer(benchmark::State& state) {
+    PoolType pool;
+    const size_t producers = state.range(0);
+    const size_t n = 1 << 16;
+    std::atomic<size_t> counter{0};
+
+    for (auto _ : state) {
+        counter = 0;
+        auto start = Clock::now();
+        std::vector<std::thread> threads;
+        for (size_t p = 0; p < producers; ++p) {
+            threads.emplace_back([&, p]() {
+                for (size_t i = n * p / producers; i < n * (p + 1) / producers;
+                     ++i) {
+                    pool.submit([&counter]() {
+                        counter.fetch_add(1, std::memory_order_release);
+                    });
+                }
+            });
+        }
+        for (auto& t : threads) {
+            t.join();
+        }
+        WaitFor(counter, n);
+        state.SetIterationTime(Seconds(Clock::now() - start));
+    }
+    state.SetItemsProcessed(state.iterations() * n);
+}
+
+// Mostly short tasks with a few that take 100x longer, in bursts, so that
+// the long ones land unevenly on the workers.
+template<typename PoolType>
+static void BM_Imbalanced(benchmark::State& state) {
+    PoolType pool;
+    const size_t n = 1 << 12;
+    std::atomic<size_t> counter{0};
+
+    for (auto _ : state) {
+        counter = 0;
+        auto start = Clock::now();
+        for (size_t i = 0; i < n; ++i) {
+            const size_t work = i % 64 < 4 ? 100000 : 1000;
+            pool.submit([&counter, work]() {
+                Spin(work);
+                counter.fetch_add(1, std::memory_order_release);
+            });
+        }
+        WaitFor(counter, n);
+        state.SetIterationTime(Seconds(Clock::now() - start));
+    }
+    state.SetItemsProcessed(state.iterations() * n);
+}
+
+#ifdef __GLIBC__
+// Heap used per task sitting in the queues, while every worker is busy
+template<typename PoolType>
+static void BM_MemoryPerTask(benchmark::State& state) {
+    const size_t n = state.range(0);
+    for (auto _ : state) {
+        PoolType pool;
+        std::atomic<bool> release{false};
+        std::atomic<size_t> busy{0};
+        for (unsigned w = 0; w < pool.size(); ++w) {
+            pool.submit([&]() {
+                busy++;
+                while (!release) {
+                    std::this_thread::yield();
+                }
+            });
+        }
+        while (busy < pool.size()) {
             std::this_thread::yield();
         }
+        std::atomic<size_t> counter{0};
+        const auto before = mallinfo2().uordblks;
+        auto start = Clock::now();
+        for (size_t i = 0; i < n; ++i) {
+            pool.submit([&counter]() {
+                counter.fetch_add(1, std::memory_order_release);
+            });
+        }
+        state.SetIterationTime(Seconds(Clock::now() - start));
+        state.counters["bytes_per_task"] = benchmark::Counter(
+            static_cast<double>(mallinfo2().uordblks - before) / n);
+        release = true;
+        WaitFor(counter, n);
+    }
+}
+#endif
+
+// Ordered updates to a few entities: a strand per entity vs. a mutex around
+// each one. Tasks go round-robin over the entities, so many contend for the
+// same one.
+template<bool UseStrands>
+static void BM_PerEntityOrder(benchmark::State& state) {
+    ThreadPool pool;
+    const size_t entities = state.range(0);
+    const size_t n = 1 << 16;
+    struct alignas(64) Entity {
+        std::mutex mutex;
+        size_t value{0};
+    };
+    std::vector<Entity> values(entities);
+    std::vector<std::unique_ptr<Strand>> strands;
+    for (size_t e = 0; e < entities; ++e) {
+        strands.push_back(std::make_unique<Strand>(pool));
+    }
+
+    for (auto _ : state) {
+        auto start = Clock::now();
+        for (size_t i = 0; i < n; ++i) {
+            auto& entity = values[i % entities];
+            if (UseStrands) {
+                strands[i % entities]->post([&entity]() {
+                    Spin(100);
+                    ++entity.value;
+                });
+            } else {
+                pool.submit([&entity]() {
+                    std::lock_guard<std::mutex> lock{entity.mutex};
+                    Spin(100);
+                    ++entity.value;
+                });
+            }
+        }
+        pool.wait_idle();
+        state.SetIterationTime(Seconds(Clock::now() - start));
+    }
+    state.SetItemsProcessed(state.iterations() * n);
+}
+
+// Recursive fork-join: fib(n) with the recursion forked down to 'cutoff', on
+// the pool (waiting workers help out), on std::async and on raw threads.
+static long Fib(int n) {
+    return n < 2 ? n : Fib(n - 1) + Fib(n - 2);
+}
+
+static long Fib(ThreadPool& pool, int n, int cutoff) {
+    if (n <= cutoff) {
+        return Fib(n);
+    }
+    long a = 0;
+    TaskGroup group(pool);
+    group.run([&]() { a = Fib(pool, n - 1, cutoff); });
+    const long b = Fib(pool, n - 2, cutoff);
+    group.wait();
+    return a + b;
+}
+
+static long FibAsync(int n, int cutoff) {
+    if (n <= cutoff) {
+        return Fib(n);
+    }
+    auto a = std::async(std::launch::async, FibAsync, n - 1, cutoff);
+    const long b = FibAsync(n - 2, cutoff);
+    return a.get() + b;
+}
+
+static long FibThreads(int n, int cutoff) {
+    if (n <= cutoff) {
+        return Fib(n);
+    }
+    long a = 0;
+    std::thread t([&]() { a = FibThreads(n - 1, cutoff); });
+    const long b = FibThreads(n - 2, cutoff);
+    t.join();
+    return a + b;
+}
 
-        auto end = std::chrono::high_resolution_clock::now();
-        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+enum class ForkJoin { kSequential, kPool, kAsync, kThreads };
 
-        state.SetIterationTime(elapsed.count() / 1e3);
-        state.SetItemsProcessed(state.range(0));
+template<ForkJoin How>
+static void BM_Fib(benchmark::State& state) {
+    ThreadPool pool;
+    const int n = 32;
+    const int cutoff = static_cast<int>(state.range(0));
+    for (auto _ : state) {
+        auto start = Clock::now();
+        long result = 0;
+        switch (How) {
+            case ForkJoin::kSequential: result = Fib(n); break;
+            case ForkJoin::kPool: result = Fib(pool, n, cutoff); break;
+            case ForkJoin::kAsync: result = FibAsync(n, cutoff); break;
+            case ForkJoin::kThreads: result = FibThreads(n, cutoff); break;
+        }
+        benchmark::DoNotOptimize(result);
+        state.SetIterationTime(Seconds(Clock::now() - start));
+    }
+}
+
+// Same work as BM_TaskThroughput<ThreadPool>, but as one bulk submission that
+// the workers split among themselves.
+static void BM_BulkThroughput(benchmark::State& state) {
+    ThreadPool pool;
+    std::atomic<size_t> counter{0};
+
+    for (auto _ : state) {
+        counter = 0;
+        pool.submit_bulk(0, static_cast<int>(state.range(0)), [&counter](int) {
+            counter.fetch_add(1, std::memory_order_relaxed);
+        }).get();
     }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    ReportStats(state, pool.stats());
+}
+
+// Results handed back through the pool's own futures vs. a std::promise that
+// the caller wraps around a plain submit().
+static void BM_FutureResults(benchmark::State& state) {
+    ThreadPool pool;
+    std::vector<Future<size_t>> futures(state.range(0));
+
+    for (auto _ : state) {
+        for (size_t i = 0; i < futures.size(); ++i) {
+            futures[i] = pool.submit(use_future, [i]() { return i; });
+        }
+        size_t sum = 0;
+        for (auto& f : futures) {
+            sum += f.get();
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+static void BM_StdPromiseResults(benchmark::State& state) {
+    ThreadPool pool;
+    std::vector<std::future<size_t>> futures(state.range(0));
+
+    for (auto _ : state) {
+        for (size_t i = 0; i < futures.size(); ++i) {
+            std::promise<size_t> promise;
+            futures[i] = promise.get_future();
+            pool.submit([i, promise = std::move(promise)]() mutable {
+                promise.set_value(i);
+            });
+        }
+        size_t sum = 0;
+        for (auto& f : futures) {
+            sum += f.get();
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// The parallel algorithms against their sequential std:: counterparts
+static std::vector<int> RandomInts(size_t n) {
+    std::mt19937 random(42);
+    std::vector<int> values(n);
+    for (auto& x : values) {
+        x = static_cast<int>(random());
+    }
+    return values;
+}
+
+template<bool Parallel>
+static void BM_Reduce(benchmark::State& state) {
+    ThreadPool pool;
+    const auto values = RandomInts(state.range(0));
+    for (auto _ : state) {
+        long sum = Parallel
+            ? parallel_reduce(pool, values, 0L)
+            : std::reduce(values.begin(), values.end(), 0L);
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+template<bool Parallel>
+static void BM_InclusiveScan(benchmark::State& state) {
+    ThreadPool pool;
+    const auto values = RandomInts(state.range(0));
+    std::vector<int> sums(values.size());
+    for (auto _ : state) {
+        if (Parallel) {
+            parallel_inclusive_scan(pool, values, sums.begin());
+        } else {
+            std::inclusive_scan(values.begin(), values.end(), sums.begin());
+        }
+        benchmark::DoNotOptimize(sums.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+template<bool Parallel>
+static void BM_Transform(benchmark::State& state) {
+    ThreadPool pool;
+    const auto values = RandomInts(state.range(0));
+    std::vector<int> out(values.size());
+    auto fn = [](int x) { return x * 7 + 3; };
+    for (auto _ : state) {
+        if (Parallel) {
+            parallel_transform(pool, values, out.begin(), fn);
+        } else {
+            std::transform(values.begin(), values.end(), out.begin(), fn);
+        }
+        benchmark::DoNotOptimize(out.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// Quicksort that forks one side of every partition, down to 'grain' elements
+template<typename It>
+static void Quicksort(ThreadPool& pool, It first, It last, size_t grain) {
+    if (static_cast<size_t>(last - first) <= grain) {
+        std::sort(first, last);
+        return;
+    }
+    const auto pivot = *(first + (last - first) / 2);
+    auto mid1 = std::partition(first, last, [&](int x) { return x < pivot; });
+    auto mid2 = std::partition(mid1, last, [&](int x) { return !(pivot < x); });
+    TaskGroup group(pool);
+    group.run([&pool, first, mid1, grain]() {
+        Quicksort(pool, first, mid1, grain);
+    });
+    Quicksort(pool, mid2, last, grain);
+    group.wait();
+}
+
+static void BM_Quicksort(benchmark::State& state) {
+    ThreadPool pool;
+    const auto values = RandomInts(state.range(0));
+    std::vector<int> data(values.size());
+    for (auto _ : state) {
+        state.PauseTiming();
+        data = values;
+        state.ResumeTiming();
+        Quicksort(pool, data.begin(), data.end(), 1 << 12);
+        benchmark::DoNotOptimize(data.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+template<bool Parallel>
+static void BM_Sort(benchmark::State& state) {
+    ThreadPool pool;
+    const auto values = RandomInts(state.range(0));
+    std::vector<int> data(values.size());
+    for (auto _ : state) {
+        state.PauseTiming();
+        data = values;
+        state.ResumeTiming();
+        if (Parallel) {
+            parallel_sort(pool, data);
+        } else {
+            std::sort(data.begin(), data.end());
+        }
+        benchmark::DoNotOptimize(data.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
 }
 
 // Register benchmarks for each thread pool type
 BENCHMARK_TEMPLATE(BM_TaskThroughput, SimpleThreadPool)
     ->Range(1<<10, 1<<20)
-    ->UseRealTime();
+    ->UseManualTime();
 
 BENCHMARK_TEMPLATE(BM_TaskThroughput, BasicThreadPool)
     ->Range(1<<10, 1<<20)
-    ->UseRealTime();
+    ->UseManualTime();
 
 BENCHMARK_TEMPLATE(BM_TaskThroughput, ThreadPool)
     ->Range(1<<10, 1<<20)
+    ->UseManualTime();
+
+BENCHMARK(BM_AsyncThroughput)->Range(1<<6, 1<<12)->UseManualTime();
+BENCHMARK(BM_ThreadThroughput)->Range(1<<6, 1<<12)->UseManualTime();
+
+BENCHMARK_TEMPLATE(BM_SubmitLatency, SimpleThreadPool)
+    ->Arg(1<<12)->UseManualTime();
+BENCHMARK_TEMPLATE(BM_SubmitLatency, BasicThreadPool)
+    ->Arg(1<<12)->UseManualTime();
+BENCHMARK_TEMPLATE(BM_SubmitLatency, ThreadPool)->Arg(1<<12)->UseManualTime();
+
+BENCHMARK_TEMPLATE(BM_WakeLatency, SimpleThreadPool)
+    ->Iterations(200)->UseManualTime();
+BENCHMARK_TEMPLATE(BM_WakeLatency, BasicThreadPool)
+    ->Iterations(200)->UseManualTime();
+BENCHMARK_TEMPLATE(BM_WakeLatency, ThreadPool)
+    ->Iterations(200)->UseManualTime();
+
+BENCHMARK_TEMPLATE(BM_MultiProducer, SimpleThreadPool)
+    ->RangeMultiplier(2)->Range(1, 8)->UseManualTime();
+BENCHMARK_TEMPLATE(BM_MultiProducer, BasicThreadPool)
+    ->RangeMultiplier(2)->Range(1, 8)->UseManualTime();
+BENCHMARK_TEMPLATE(BM_MultiProducer, ThreadPool)
+    ->RangeMultiplier(2)->Range(1, 8)->UseManualTime();
+
+BENCHMARK_TEMPLATE(BM_Imbalanced, SimpleThreadPool)->UseManualTime();
+BENCHMARK_TEMPLATE(BM_Imbalanced, BasicThreadPool)->UseManualTime();
+BENCHMARK_TEMPLATE(BM_Imbalanced, ThreadPool)->UseManualTime();
+
+#ifdef __GLIBC__
+BENCHMARK_TEMPLATE(BM_MemoryPerTask, SimpleThreadPool)
+    ->Arg(1<<18)->Iterations(3)->UseManualTime();
+BENCHMARK_TEMPLATE(BM_MemoryPerTask, BasicThreadPool)
+    ->Arg(1<<18)->Iterations(3)->UseManualTime();
+BENCHMARK_TEMPLATE(BM_MemoryPerTask, ThreadPool)
+    ->Arg(1<<18)->Iterations(3)->UseManualTime();
+#endif
+
+BENCHMARK_TEMPLATE(BM_PerEntityOrder, false)
+    ->RangeMultiplier(8)->Range(1, 512)->UseManualTime();
+BENCHMARK_TEMPLATE(BM_PerEntityOrder, true)
+    ->RangeMultiplier(8)->Range(1, 512)->UseManualTime();
+
+BENCHMARK_TEMPLATE(BM_Fib, ForkJoin::kSequential)->Arg(0)->UseManualTime();
+BENCHMARK_TEMPLATE(BM_Fib, ForkJoin::kPool)
+    ->DenseRange(12, 24, 6)->UseManualTime();
+BENCHMARK_TEMPLATE(BM_Fib, ForkJoin::kAsync)
+    ->DenseRange(18, 24, 6)->UseManualTime();
+BENCHMARK_TEMPLATE(BM_Fib, ForkJoin::kThreads)
+    ->DenseRange(18, 24, 6)->UseManualTime();
+
+BENCHMARK(BM_BulkThroughput)->Range(1<<10, 1<<20)->UseRealTime();
+
+BENCHMARK(BM_FutureResults)->Range(1<<10, 1<<16)->UseRealTime();
+BENCHMARK(BM_StdPromiseResults)->Range(1<<10, 1<<16)->UseRealTime();
+
+BENCHMARK_TEMPLATE(BM_Reduce, false)->RangeMultiplier(4)->Range(1<<16, 1<<26);
+BENCHMARK_TEMPLATE(BM_Reduce, true)->RangeMultiplier(4)->Range(1<<16, 1<<26)
+    ->UseRealTime();
+BENCHMARK_TEMPLATE(BM_InclusiveScan, false)
+    ->RangeMultiplier(4)->Range(1<<16, 1<<26);
+BENCHMARK_TEMPLATE(BM_InclusiveScan, true)
+    ->RangeMultiplier(4)->Range(1<<16, 1<<26)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_Transform, false)
+    ->RangeMultiplier(4)->Range(1<<16, 1<<26);
+BENCHMARK_TEMPLATE(BM_Transform, true)
+    ->RangeMultiplier(4)->Range(1<<16, 1<<26)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_Sort, false)->RangeMultiplier(4)->Range(1<<16, 1<<26);
+BENCHMARK_TEMPLATE(BM_Sort, true)->RangeMultiplier(4)->Range(1<<16, 1<<26)
+    ->UseRealTime();
+BENCHMARK(BM_Quicksort)->RangeMultiplier(4)->Range(1<<16, 1<<24)
     ->UseRealTime();
 
 BENCHMARK_MAIN();
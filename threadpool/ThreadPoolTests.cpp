@@ -1,9 +1,25 @@
+#include <algorithm>
 #include <atomic>
 #include <cassert>
 #include <chrono>
+#include <ctime>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <ranges>
+#include <stdexcept>
+#include <string>
 #include <thread>
 #include <vector>
 
+#include "Coroutine.h"
+#include "ParallelAlgorithms.h"
+#include "Strand.h"
+#include "TaskGraph.h"
+#include "TaskGroup.h"
 #include "ThreadPool.h"
 #include "gtest/gtest.h"
 
@@ -30,6 +46,20 @@ TEST(BasicThreadPool, MultipleTasks) {
   EXPECT_EQ(counter, numTasks);
 }
 
+TEST(BasicThreadPool, ParksWhenIdle) {
+  BasicThreadPool pool({.spin = 16, .backoff = 4});
+  std::atomic<int> counter{0};
+
+  const auto start = std::clock();
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  const auto cpuMs = (std::clock() - start) * 1000.0 / CLOCKS_PER_SEC;
+  EXPECT_LT(cpuMs, 50.0);
+
+  pool.submit([&counter]() { counter++; });
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  EXPECT_EQ(counter, 1);
+}
+
 TEST(SimpleThreadPool, SingleTask) {
   SimpleThreadPool pool;
   std::atomic<bool> taskExecuted{false};
@@ -53,6 +83,940 @@ TEST(SimpleThreadPool, MultipleTasks) {
   EXPECT_EQ(counter, numTasks);
 }
 
+TEST(ThreadPool, SingleTask) {
+  ThreadPool pool;
+  std::atomic<bool> taskExecuted{false};
+
+  pool.submit([&taskExecuted]() { taskExecuted = true; });
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  EXPECT_TRUE(taskExecuted);
+}
+
+TEST(ThreadPool, MultipleTasks) {
+  std::atomic<int> counter{0};
+
+  const int numTasks = 10000;
+  {
+    ThreadPool pool;
+    for (int i = 0; i < numTasks; ++i) {
+      pool.submit([&counter]() { counter++; });
+    }
+  }  // The destructor runs every pending task before joining.
+
+  EXPECT_EQ(counter, numTasks);
+}
+
+TEST(ThreadPool, MoveOnlyTask) {
+  std::atomic<int> result{0};
+  {
+    ThreadPool pool;
+    auto value = std::make_unique<int>(42);
+    pool.submit([&result, value = std::move(value)]() { result = *value; });
+  }
+  EXPECT_EQ(result, 42);
+}
+
+TEST(ThreadPool, ParksWhenIdle) {
+  ThreadPool pool({.idle = {.spin = 16, .backoff = 4}});
+  pool.submit(use_future, []() {}).get();
+
+  // Workers that are asleep don't use any CPU...
+  const auto start = std::clock();
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  const auto cpuMs = (std::clock() - start) * 1000.0 / CLOCKS_PER_SEC;
+  EXPECT_LT(cpuMs, 50.0);
+
+  // ...and a submit wakes one of them up.
+  EXPECT_EQ(pool.submit(use_future, []() { return 7; }).get(), 7);
+}
+
+// Runs the tasks of two lanes that pile up while all workers are busy, and
+// returns the lanes in the order the tasks ran.
+static std::vector<unsigned> runLanes(unsigned starvationLimit) {
+  ThreadPoolOptions options;
+  options.priorities = 2;
+  options.starvation_limit = starvationLimit;
+  ThreadPool pool(options);
+  const unsigned nworkers = pool.size();
+  std::atomic<unsigned> blocked{0};
+  std::atomic<bool> release{false};
+  for (unsigned n = 0; n < nworkers; ++n) {
+    pool.submit([&]() {
+      blocked++;
+      while (!release) {
+        std::this_thread::yield();
+      }
+    });
+  }
+  while (blocked < nworkers) {
+    std::this_thread::yield();
+  }
+
+  std::mutex mutex;
+  std::vector<unsigned> order;
+  for (unsigned n = 0; n < 8; ++n) {
+    pool.submit(1, [&]() {
+      std::lock_guard<std::mutex> lock{mutex};
+      order.push_back(1);
+    });
+  }
+  for (unsigned n = 0; n < 64; ++n) {
+    pool.submit(0, [&]() {
+      std::lock_guard<std::mutex> lock{mutex};
+      order.push_back(0);
+    });
+  }
+  release = true;
+  while (true) {
+    std::lock_guard<std::mutex> lock{mutex};
+    if (order.size() == 72) {
+      return order;
+    }
+  }
+}
+
+TEST(ThreadPool, HigherLanesFirst) {
+  auto order = runLanes(0);
+  // Other workers may each still be running one high task when the first low
+  // one starts.
+  const auto slack = Topology::availableCpus() - 1;
+  EXPECT_EQ(std::count(order.end() - 8 - slack, order.end(), 1u), 8);
+}
+
+TEST(ThreadPool, LowLanesDontStarve) {
+  auto order = runLanes(4);
+  auto firstLow = std::find(order.begin(), order.end(), 1u);
+  auto lastHigh = std::find(order.rbegin(), order.rend(), 0u).base();
+  EXPECT_LT(firstLow, lastHigh);
+}
+
+TEST(ThreadPool, SubmitWithFuture) {
+  ThreadPool pool;
+
+  std::vector<Future<int>> futures;
+  for (int i = 0; i < 1000; ++i) {
+    futures.push_back(pool.submit(use_future, [i]() { return i * i; }));
+  }
+  for (int i = 0; i < 1000; ++i) {
+    EXPECT_EQ(futures[i].get(), i * i);
+    EXPECT_FALSE(futures[i].valid());
+  }
+
+  auto text = pool.submit(use_future, []() { return std::string(100, 'x'); });
+  EXPECT_EQ(text.get(), std::string(100, 'x'));
+
+  auto fails = pool.submit(use_future, []() { throw std::runtime_error("boom"); });
+  EXPECT_THROW(fails.get(), std::runtime_error);
+}
+
+TEST(ThreadPool, ParallelFor) {
+  ThreadPool pool;
+  const int n = 100000;
+  std::vector<int> values(n, 0);
+
+  pool.parallel_for(std::views::iota(0, n), 64, [&](int i) { values[i] = i; });
+  for (int i = 0; i < n; ++i) {
+    ASSERT_EQ(values[i], i);
+  }
+
+  pool.parallel_for(values, 64, [](int& x) { x *= 2; });
+  EXPECT_EQ(values[n - 1], 2 * (n - 1));
+
+  EXPECT_THROW(pool.parallel_for(std::views::iota(0, n), 64,
+                                 [](int i) {
+                                   if (i == 1234) {
+                                     throw std::runtime_error("boom");
+                                   }
+                                 }),
+               std::runtime_error);
+}
+
+TEST(ThreadPool, SubmitBulk) {
+  ThreadPool pool;
+  std::atomic<long> sum{0};
+
+  auto done = pool.submit_bulk(0, 10000, [&sum](int i) { sum += i; });
+  done.get();
+  EXPECT_EQ(sum, 10000L * 9999 / 2);
+
+  // Nested loops, from inside a task, on a worker that helps while it waits
+  std::atomic<int> count{0};
+  pool.submit(use_future, [&]() {
+        pool.parallel_for(std::views::iota(0, 100), 1, [&](int) {
+          pool.parallel_for(std::views::iota(0, 100), 1, [&](int) { count++; });
+        });
+      }).get();
+  EXPECT_EQ(count, 100 * 100);
+}
+
+TEST(TaskGraph, RunsInDependencyOrder) {
+  ThreadPool pool;
+  TaskGraph graph;
+  std::vector<int> order;
+  std::mutex mutex;
+  auto record = [&](int id) {
+    return [&, id]() {
+      std::lock_guard<std::mutex> lock{mutex};
+      order.push_back(id);
+    };
+  };
+
+  // A diamond: 0 -> {1, 2} -> 3
+  auto a = graph.add_node(record(0));
+  auto b = graph.add_node(record(1));
+  auto c = graph.add_node(record(2));
+  auto d = graph.add_node(record(3));
+  graph.add_edge(a, b);
+  graph.add_edge(a, c);
+  graph.add_edge(b, d);
+  graph.add_edge(c, d);
+
+  for (int run = 0; run < 100; ++run) {
+    order.clear();
+    graph.run(pool).get();
+    ASSERT_EQ(order.size(), 4u);
+    EXPECT_EQ(order.front(), 0);
+    EXPECT_EQ(order.back(), 3);
+  }
+}
+
+TEST(TaskGraph, PropagatesExceptions) {
+  ThreadPool pool;
+  TaskGraph graph;
+  std::atomic<bool> ranAfter{false};
+
+  auto a = graph.add_node([]() { throw std::runtime_error("boom"); });
+  auto b = graph.add_node([&ranAfter]() { ranAfter = true; });
+  graph.add_edge(a, b);
+
+  EXPECT_THROW(graph.run(pool).get(), std::runtime_error);
+  EXPECT_FALSE(ranAfter);
+}
+
+TEST(ThreadPool, PinnedWorkers) {
+  ThreadPoolOptions options;
+  options.pin = true;
+  ThreadPool pool(options);
+  std::atomic<int> count{0};
+  for (int i = 0; i < 1000; ++i) {
+    pool.submit([&]() { count++; });
+  }
+  while (count < 1000) {
+    std::this_thread::yield();
+  }
+  EXPECT_EQ(count, 1000);
+}
+
+TEST(ThreadPool, ExplicitSize) {
+  EXPECT_EQ(BasicThreadPool(3).size(), 3u);
+  EXPECT_EQ(SimpleThreadPool(2).size(), 2u);
+  ThreadPool pool(2);
+  EXPECT_EQ(pool.size(), 2u);
+  EXPECT_EQ(pool.capacity(), 2u);
+  EXPECT_GE(Topology::availableCpus(), 1u);
+  EXPECT_EQ(Topology::quotaCpus("150000 100000"), 2u);
+  EXPECT_EQ(Topology::quotaCpus("max 100000"), 0u);
+}
+
+static bool eventually(const std::function<bool()>& condition) {
+  const auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (!condition()) {
+    if (std::chrono::steady_clock::now() > deadline) {
+      return false;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return true;
+}
+
+TEST(ThreadPool, GrowsUnderBacklogAndShrinksWhenIdle) {
+  ThreadPoolOptions options;
+  options.threads = 1;
+  options.max_threads = 4;
+  options.idle_timeout = std::chrono::milliseconds(20);
+  ThreadPool pool(options);
+  EXPECT_EQ(pool.size(), 1u);
+
+  // Tie up the only worker, so that everything else piles up.
+  std::atomic<bool> release{false};
+  std::atomic<bool> blocked{false};
+  std::atomic<bool> grew{false};
+  std::atomic<int> count{0};
+  pool.submit([&]() {
+    blocked = true;
+    while (!release) {
+      std::this_thread::yield();
+    }
+  });
+  // Otherwise the worker may take everything at once and run the rest first.
+  EXPECT_TRUE(eventually([&] { return blocked.load(); }));
+  for (int i = 0; i < 1000; ++i) {
+    pool.submit([&]() {
+      if (pool.size() > 1) {
+        grew = true;
+      }
+      count++;
+    });
+  }
+  EXPECT_TRUE(eventually([&] { return count == 1000; }));
+  EXPECT_TRUE(grew);
+  release = true;
+  EXPECT_TRUE(eventually([&] { return pool.size() == 1; }));
+
+  pool.resize(3);
+  EXPECT_EQ(pool.size(), 3u);
+  pool.resize(1);
+  EXPECT_TRUE(eventually([&] { return pool.size() == 1; }));
+  auto f = pool.submit(use_future, []() { return 42; });
+  EXPECT_EQ(f.get(), 42);
+}
+
+TEST(ParallelAlgorithms, TransformAndReduce) {
+  ThreadPool pool(3);
+  std::vector<long> values(200000);
+  std::iota(values.begin(), values.end(), 0);
+  std::vector<long> squares(values.size());
+  parallel_transform(pool, values, squares.begin(),
+                     [](long x) { return x * x; });
+  EXPECT_EQ(squares[199999], 199999L * 199999);
+  EXPECT_EQ(parallel_reduce(pool, values, 0L), 199999L * 200000 / 2);
+  EXPECT_EQ(parallel_reduce(pool, std::vector<long>{}, 7L), 7);
+  // Not commutative: blocks must be combined in order.
+  std::vector<std::string> words(100000, "a");
+  words.back() = "b";
+  EXPECT_EQ(parallel_reduce(pool, words, std::string()).back(), 'b');
+}
+
+TEST(ParallelAlgorithms, InclusiveScan) {
+  ThreadPool pool(3);
+  std::vector<long> values(200001, 1);
+  std::vector<long> sums(values.size());
+  parallel_inclusive_scan(pool, values, sums.begin());
+  for (size_t i = 0; i < sums.size(); ++i) {
+    ASSERT_EQ(sums[i], static_cast<long>(i + 1));
+  }
+  parallel_inclusive_scan(pool, sums, sums.begin(), std::plus<>());
+  EXPECT_EQ(sums.back(), 200001L * 200002 / 2);
+}
+
+TEST(ParallelAlgorithms, Sort) {
+  ThreadPool pool(3);
+  std::mt19937 random(42);
+  // Strings, so that reading an element after it was moved out would show.
+  std::vector<std::string> values(300007);
+  for (auto& x : values) {
+    x = std::to_string(random() % 1000);
+  }
+  auto expected = values;
+  std::sort(expected.begin(), expected.end());
+  parallel_sort(pool, values);
+  EXPECT_EQ(values, expected);
+
+  parallel_sort(pool, values, std::greater<>());
+  std::reverse(expected.begin(), expected.end());
+  EXPECT_EQ(values, expected);
+}
+
+TEST(ThreadPool, NestedSubmitStaysLocal) {
+  ThreadPool pool(1);
+  std::atomic<int> count{0};
+  pool.submit([&]() {
+    for (int i = 0; i < 100; ++i) {
+      pool.submit([&]() { count++; });
+    }
+  });
+  EXPECT_TRUE(eventually([&] { return pool.stats().total().executed == 101; }));
+  EXPECT_EQ(count, 100);
+  // The outer task came through the worker's queue, the others went straight
+  // to its deque.
+  EXPECT_EQ(pool.stats().total().local_pops, 101u);
+  EXPECT_EQ(pool.stats().push_contended, 0u);
+}
+
+TEST(Topology, ParsesCpuLists) {
+  EXPECT_EQ(Topology::parseList("0-3,8,10-11\n"),
+            (std::vector<unsigned>{0, 1, 2, 3, 8, 10, 11}));
+  EXPECT_TRUE(Topology::parseList("").empty());
+  EXPECT_GE(Topology::detect().size(), 1u);
+}
+
+TEST(Topology, StealsFromClosestFirst) {
+  // Two nodes with an LLC each, two cores per LLC, two threads per core
+  std::vector<Topology::Cpu> cpus;
+  for (unsigned id = 0; id != 8; ++id) {
+    cpus.push_back({id, id & ~1u, id & ~3u, id / 4});
+  }
+  Topology topology(cpus);
+  EXPECT_EQ(topology.victims(0, 8),
+            (std::vector<unsigned>{1, 2, 3, 4, 5, 6, 7}));
+  EXPECT_EQ(topology.victims(6, 8),
+            (std::vector<unsigned>{7, 4, 5, 0, 1, 2, 3}));
+}
+
+static CoTask<int> square(ThreadPool& pool, int x) {
+  co_await pool.schedule();
+  co_return x * x;
+}
+
+static CoTask<int> sumOfSquares(ThreadPool& pool, int n) {
+  int sum = 0;
+  for (int i = 1; i <= n; ++i) {
+    sum += co_await square(pool, i);
+  }
+  co_return sum;
+}
+
+static CoTask<> fails(ThreadPool& pool) {
+  co_await pool.schedule();
+  throw std::runtime_error("boom");
+}
+
+TEST(CoTask, AwaitsOnThePool) {
+  ThreadPool pool;
+  EXPECT_EQ(start(pool, sumOfSquares(pool, 100)).get(), 338350);
+  EXPECT_THROW(start(pool, fails(pool)).get(), std::runtime_error);
+}
+
+TEST(CoTask, ScheduleMovesToAWorker) {
+  ThreadPool pool;
+  auto caller = std::this_thread::get_id();
+  auto hop = [](ThreadPool& pool) -> CoTask<std::thread::id> {
+    co_await pool.schedule();
+    co_return std::this_thread::get_id();
+  };
+  EXPECT_NE(start(pool, hop(pool)).get(), caller);
+}
+
+template <typename Pool>
+static PoolStats countedRun(Pool& pool, unsigned n) {
+  for (unsigned i = 0; i < n; ++i) {
+    pool.submit([]() {});
+  }
+  // Counters are bumped right after each task, so wait for them instead of
+  // for the tasks.
+  auto stats = pool.stats();
+  while (stats.total().executed < n) {
+    std::this_thread::yield();
+    stats = pool.stats();
+  }
+  return stats;
+}
+
+TEST(PoolStats, CountsWhatWorkersDo) {
+  BasicThreadPool basic;
+  auto stats = countedRun(basic, 1000);
+  EXPECT_EQ(stats.workers.size(), basic.size());
+  EXPECT_EQ(stats.total().executed, 1000u);
+  EXPECT_GE(stats.total().waitSamples(), 1000u / 64);
+
+  SimpleThreadPool simple;
+  EXPECT_EQ(countedRun(simple, 1000).total().executed, 1000u);
+
+  ThreadPool pool;
+  stats = countedRun(pool, 1000);
+  const auto total = stats.total();
+  EXPECT_EQ(total.executed, 1000u);
+  EXPECT_EQ(total.local_pops + total.steals, 1000u);
+  EXPECT_GE(total.steal_attempts, total.steals);
+  EXPECT_GE(total.waitSamples(), 1000u / 64);
+  EXPECT_GE(total.parks, total.unparks);
+}
+
+TEST(PoolStats, SamplingNeverAllocates) {
+  struct Small {
+    char bytes[kTaskInlineSize - 8];
+    void operator()() {}
+  };
+  struct Full {
+    char bytes[kTaskInlineSize];
+    void operator()() {}
+  };
+  struct Big {
+    char bytes[2 * kTaskInlineSize];
+    void operator()() {}
+  };
+  // Room for the time stamp, or on the heap anyway
+  static_assert(WorkerCounters::timeable<Small>());
+  static_assert(Task::storedInline<WorkerCounters::Timed<Small>>());
+  static_assert(WorkerCounters::timeable<Big>());
+  // Timing these would add an allocation, so they're never sampled.
+  static_assert(!WorkerCounters::timeable<Full>());
+  static_assert(!WorkerCounters::timeable<Task>());
+  for (int i = 0; i < 1000; ++i) {
+    EXPECT_FALSE(WorkerCounters::sample<Task>());
+  }
+}
+
+TEST(PoolStats, WaitPercentiles) {
+  WorkerStats stats;
+  stats.wait[10] = 90;  // [512, 1024) ns
+  stats.wait[20] = 10;  // [512, 1024) us
+  EXPECT_EQ(stats.waitPercentile(0.5), 1024u);
+  EXPECT_EQ(stats.waitPercentile(0.95), 1u << 20);
+  EXPECT_EQ(stats.waitPercentile(1.0), 1u << 20);
+  EXPECT_EQ(WorkerStats{}.waitPercentile(0.5), 0u);
+}
+
+TEST(TimerWheel, FiresInOrderAcrossLevels) {
+  TimerWheel wheel;
+  std::vector<uint64_t> fired;
+  std::vector<TimerId> ids;
+  // Deadlines in every level, some in the same slot
+  for (uint64_t deadline : {0, 1, 255, 256, 257, 70000, 70000, 20000000}) {
+    ids.push_back(wheel.add(deadline, [&fired, deadline] {
+      fired.push_back(deadline);
+    }));
+  }
+  auto cancelled = wheel.add(300, [] { FAIL(); });
+  EXPECT_TRUE(wheel.cancel(cancelled));
+  EXPECT_FALSE(wheel.cancel(cancelled));
+  EXPECT_EQ(wheel.size(), 8u);
+
+  std::vector<Task> expired;
+  for (uint64_t tick : {0, 256, 69999, 70000, 30000000}) {
+    wheel.advance(tick, expired);
+    for (auto& task : expired) {
+      task();
+    }
+    expired.clear();
+  }
+  EXPECT_EQ(fired, (std::vector<uint64_t>{0, 1, 255, 256, 257, 70000, 70000,
+                                           20000000}));
+  EXPECT_EQ(wheel.size(), 0u);
+  // Fired timers can't be cancelled, even if their node is reused.
+  wheel.add(40000000, [] {});
+  EXPECT_FALSE(wheel.cancel(ids.back()));
+}
+
+// Past the 2^32 ticks the levels cover, timers neither fire early nor index
+// past the top level.
+TEST(TimerWheel, FarTimersFireOnTime) {
+  TimerWheel wheel;
+  const uint64_t far = (uint64_t{1} << 34) + 5;
+  const uint64_t period = (uint64_t{1} << 33) + 3;
+  std::vector<uint64_t> fired;
+  wheel.add(far, [&] { fired.push_back(far); });
+  wheel.add(0, [&] { fired.push_back(period); }, period);
+
+  std::vector<Task> expired;
+  auto advance = [&](uint64_t tick) {
+    wheel.advance(tick, expired);
+    for (auto& task : expired) {
+      task();
+    }
+    expired.clear();
+  };
+  advance(period - 1);
+  EXPECT_EQ(fired, std::vector<uint64_t>{period});
+  advance(period);
+  EXPECT_EQ(fired, (std::vector<uint64_t>{period, period}));
+  advance(far - 1);
+  EXPECT_EQ(fired.size(), 2u);
+  advance(far);
+  EXPECT_EQ(fired, (std::vector<uint64_t>{period, period, far}));
+  EXPECT_EQ(wheel.size(), 1u);
+}
+
+TEST(ThreadPool, SubmitAfterAndEvery) {
+  using namespace std::chrono_literals;
+  ThreadPool pool;
+  // Nothing to cancel yet (and no timer thread to start for it)
+  EXPECT_FALSE(pool.cancel(TimerId{}));
+  const auto start = std::chrono::steady_clock::now();
+  std::atomic<bool> fired{false};
+  std::atomic<std::chrono::steady_clock::duration> after{};
+  pool.submit_after(20ms, [&] {
+    after = std::chrono::steady_clock::now() - start;
+    fired = true;
+  });
+  auto never = pool.submit_after(10ms, [] { FAIL(); });
+  EXPECT_TRUE(pool.cancel(never));
+
+  std::atomic<int> ticks{0};
+  auto every = pool.submit_every(1ms, [&] { ticks++; });
+  EXPECT_TRUE(eventually([&] { return fired && ticks >= 10; }));
+  EXPECT_GE(after.load(), 20ms);
+  EXPECT_TRUE(pool.cancel(every));
+  std::this_thread::sleep_for(5ms);
+  // Runs that were already handed out may still finish.
+  const int stopped = ticks;
+  std::this_thread::sleep_for(20ms);
+  EXPECT_EQ(ticks, stopped);
+}
+
+TEST(ThreadPoolDeathTest, SubmitEveryNeedsAPeriod) {
+  using namespace std::chrono_literals;
+  EXPECT_DEATH(
+      {
+        ThreadPool pool(1);
+        pool.submit_every(0ms, [] {});
+      },
+      "");
+}
+
+static long fib(ThreadPool& pool, int n) {
+  if (n < 12) {
+    return n < 2 ? n : fib(pool, n - 1) + fib(pool, n - 2);
+  }
+  long a = 0;
+  TaskGroup group(pool);
+  group.run([&] { a = fib(pool, n - 1); });
+  const long b = fib(pool, n - 2);
+  group.wait();
+  return a + b;
+}
+
+TEST(TaskGroup, NestedWaitsHelpInsteadOfBlocking) {
+  // Far more nested waits than workers: they only finish if waiting workers
+  // run the tasks they wait for.
+  ThreadPool pool(2);
+  TaskGroup group(pool);
+  long result = 0;
+  group.run([&] { result = fib(pool, 25); });
+  group.wait();
+  EXPECT_EQ(result, 75025);
+}
+
+TEST(TaskGroup, RethrowsAndCanBeReused) {
+  ThreadPool pool;
+  TaskGroup group(pool);
+  std::atomic<int> count{0};
+  for (int i = 0; i < 100; ++i) {
+    group.run([&count, i] {
+      count++;
+      if (i == 50) {
+        throw std::runtime_error("oops");
+      }
+    });
+  }
+  EXPECT_THROW(group.wait(), std::runtime_error);
+  count = 0;
+  for (int i = 0; i < 100; ++i) {
+    group.run([&count] { count++; });
+  }
+  group.wait();
+  EXPECT_EQ(count, 100);
+}
+
+// A wait that helps may run another group's task that throws. The exception
+// goes to that group, not to the waiter, and the pool still goes idle.
+TEST(TaskGroup, HelpingLeavesOtherGroupsExceptionsAlone) {
+  ThreadPool pool(1);
+  TaskGroup outer(pool);
+  bool innerThrew = false;
+  outer.run([&] {
+    TaskGroup inner(pool);
+    inner.run([] {});
+    // The worker's deque is LIFO, so the inner wait runs this one first.
+    outer.run([] { throw std::runtime_error("boom"); });
+    try {
+      inner.wait();
+    } catch (...) {
+      innerThrew = true;
+    }
+  });
+  EXPECT_THROW(outer.wait(), std::runtime_error);
+  EXPECT_FALSE(innerThrew);
+  pool.wait_idle();
+}
+
+// Plain tasks must not throw, even when a waiter that helps runs them.
+TEST(ThreadPoolDeathTest, ThrowingTaskTerminatesWhileHelping) {
+  EXPECT_DEATH(
+      {
+        ThreadPool pool(1);
+        auto waited = pool.submit(use_future, [&] {
+          TaskGroup group(pool);
+          group.run([] {});
+          pool.submit([] { throw std::runtime_error("boom"); });
+          group.wait();
+        });
+        waited.get();
+      },
+      "");
+}
+
+TEST(ThreadPool, WaitIdleWaitsForNestedTasks) {
+  ThreadPool pool;
+  std::atomic<int> count{0};
+  for (int i = 0; i < 100; ++i) {
+    pool.submit([&] {
+      for (int j = 0; j < 10; ++j) {
+        pool.submit([&] {
+          std::this_thread::sleep_for(std::chrono::microseconds(100));
+          count++;
+        });
+      }
+    });
+  }
+  pool.wait_idle();
+  EXPECT_EQ(count, 1000);
+  pool.wait_idle();
+}
+
+// A pool with one worker, busy until 'release' is set, and queues that hold
+// four tasks
+static void withBusyBoundedPool(Overflow overflow,
+                                const std::function<void(ThreadPool&)>& fn) {
+  ThreadPoolOptions options;
+  options.threads = 1;
+  options.queue_capacity = 4;
+  options.overflow = overflow;
+  ThreadPool pool(options);
+  std::atomic<bool> blocked{false};
+  std::atomic<bool> release{false};
+  pool.submit([&] {
+    blocked = true;
+    while (!release) {
+      std::this_thread::yield();
+    }
+  });
+  ASSERT_TRUE(eventually([&] { return blocked.load(); }));
+  std::thread releaser([&] {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    release = true;
+  });
+  fn(pool);
+  releaser.join();
+  pool.wait_idle();
+}
+
+TEST(ThreadPool, BoundedTrySubmitFailsWhenFull) {
+  withBusyBoundedPool(Overflow::kBlock, [](ThreadPool& pool) {
+    std::atomic<int> count{0};
+    int accepted = 0;
+    while (pool.try_submit([&] { count++; })) {
+      ++accepted;
+    }
+    EXPECT_EQ(accepted, 4);
+    // A failed try_submit leaves f alone, even when it's moved in (and
+    // whether or not the submission gets sampled).
+    struct Owner {
+      std::unique_ptr<int> p;
+      void operator()() {}
+    };
+    for (int i = 0; i < 200; ++i) {
+      Owner owner{std::make_unique<int>(i)};
+      EXPECT_FALSE(pool.try_submit(std::move(owner)));
+      EXPECT_TRUE(owner.p);
+    }
+    // Blocks until the worker makes room.
+    for (int i = 0; i < 100; ++i) {
+      pool.submit([&] { count++; });
+    }
+    pool.wait_idle();
+    EXPECT_EQ(count, 104);
+  });
+}
+
+TEST(ThreadPool, BoundedCallerRuns) {
+  withBusyBoundedPool(Overflow::kCallerRuns, [](ThreadPool& pool) {
+    std::atomic<int> here{0};
+    std::atomic<int> count{0};
+    const auto caller = std::this_thread::get_id();
+    for (int i = 0; i < 10; ++i) {
+      pool.submit([&] {
+        if (std::this_thread::get_id() == caller) {
+          here++;
+        }
+        count++;
+      });
+    }
+    EXPECT_EQ(here, 6);
+    pool.wait_idle();
+    EXPECT_EQ(count, 10);
+  });
+}
+
+// Bulk pieces that don't fit run on the caller too, whole: the caller isn't a
+// worker, so it has no deque to split them into.
+TEST(ThreadPool, BoundedCallerRunsBulk) {
+  withBusyBoundedPool(Overflow::kCallerRuns, [](ThreadPool& pool) {
+    for (int i = 0; i < 4; ++i) {
+      pool.submit([] {});
+    }
+    std::atomic<int> elsewhere{0};
+    const auto caller = std::this_thread::get_id();
+    auto done = pool.submit_bulk(0, 1000, [&](int) {
+      if (std::this_thread::get_id() != caller) {
+        elsewhere++;
+      }
+    });
+    EXPECT_TRUE(done.ready());
+    EXPECT_EQ(elsewhere, 0);
+    done.get();
+  });
+}
+
+TEST(Strand, RunsInOrderOneAtATime) {
+  ThreadPool pool;
+  Strand strand(pool);
+  const int producers = 4;
+  const int perProducer = 10000;
+  std::atomic<bool> inside{false};
+  std::atomic<bool> overlapped{false};
+  // Only touched from the strand, so no atomics needed
+  std::vector<int> last(producers, -1);
+  bool ordered = true;
+  int ran = 0;
+
+  std::vector<std::thread> threads;
+  for (int p = 0; p < producers; ++p) {
+    threads.emplace_back([&, p] {
+      for (int i = 0; i < perProducer; ++i) {
+        strand.post([&, p, i] {
+          if (inside.exchange(true)) {
+            overlapped = true;
+          }
+          ordered &= last[p] == i - 1;
+          last[p] = i;
+          ++ran;
+          inside = false;
+        });
+      }
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  pool.wait_idle();
+  EXPECT_FALSE(strand.busy());
+  EXPECT_FALSE(overlapped);
+  EXPECT_TRUE(ordered);
+  EXPECT_EQ(ran, producers * perProducer);
+}
+
+TEST(Strand, StrandsRunInParallel) {
+  ThreadPool pool(4);
+  std::vector<std::unique_ptr<Strand>> strands;
+  std::vector<int> counts(16, 0);
+  for (size_t s = 0; s < counts.size(); ++s) {
+    strands.push_back(std::make_unique<Strand>(pool));
+  }
+  // Posted from the pool too, into other strands
+  for (int i = 0; i < 1000; ++i) {
+    pool.submit([&, i] {
+      for (size_t s = 0; s < counts.size(); ++s) {
+        strands[(s + i) % counts.size()]->post(
+            [&counts, s = (s + i) % counts.size()] { counts[s]++; });
+      }
+    });
+  }
+  pool.wait_idle();
+  for (auto count : counts) {
+    EXPECT_EQ(count, 1000);
+  }
+}
+
+// A task that throws must not stop the strand, nor reach whatever else the
+// worker is doing, such as a task waiting on a group that helps.
+TEST(Strand, SurvivesThrowingTask) {
+  ThreadPool pool(1);
+  std::promise<std::string> error;
+  Strand strand(pool, [&](std::exception_ptr e) {
+    try {
+      std::rethrow_exception(e);
+    } catch (const std::exception& x) {
+      error.set_value(x.what());
+    }
+  });
+  std::promise<int> after;
+  auto waited = pool.submit(use_future, [&] {
+    TaskGroup group(pool);
+    group.run([] {});
+    // The worker's deque is LIFO, so the wait runs the strand first.
+    strand.post([] { throw std::runtime_error("boom"); });
+    strand.post([&] { after.set_value(1); });
+    group.wait();
+  });
+  EXPECT_NO_THROW(waited.get());
+  EXPECT_EQ(error.get_future().get(), "boom");
+  // The task behind the one that threw still runs, and so do new ones.
+  EXPECT_EQ(after.get_future().get(), 1);
+  std::promise<int> later;
+  strand.post([&] { later.set_value(2); });
+  EXPECT_EQ(later.get_future().get(), 2);
+  pool.wait_idle();
+}
+
+TEST(Task, StoresSmallCallablesInline) {
+  static_assert(sizeof(Task) == 64);
+
+  int* a = nullptr;
+  int* b = nullptr;
+  auto p = std::make_unique<int>(1);
+  auto small = [a, b, p = std::move(p)]() { (void)a, (void)b; };
+  EXPECT_TRUE(Task::storedInline<decltype(small)>());
+
+  char big[128] = {};
+  auto large = [big]() { (void)big; };
+  EXPECT_FALSE(Task::storedInline<decltype(large)>());
+
+  int calls = 0;
+  Task t1{[&calls, big]() { calls += 1 + big[0]; }};
+  Task t2{std::move(t1)};
+  EXPECT_FALSE(t1);
+  ASSERT_TRUE(t2);
+  t2();
+  EXPECT_EQ(calls, 1);
+}
+
+TEST(WorkStealingDeque, OwnerIsLifoThiefIsFifo) {
+  WorkStealingDeque<int> deque(2);
+  for (int i = 0; i < 10; ++i) {
+    deque.push(i);  // Grows past the initial capacity
+  }
+
+  int value;
+  EXPECT_TRUE(deque.steal(value));
+  EXPECT_EQ(value, 0);
+  EXPECT_TRUE(deque.pop(value));
+  EXPECT_EQ(value, 9);
+  EXPECT_EQ(deque.sizeEstimate(), 8u);
+}
+
+TEST(WorkStealingDeque, ConcurrentSteals) {
+  const int numItems = 100000;
+  WorkStealingDeque<int> deque;
+  std::atomic<long> sum{0};
+  std::atomic<int> taken{0};
+
+  std::vector<std::thread> thieves;
+  for (int n = 0; n < 3; ++n) {
+    thieves.emplace_back([&] {
+      while (taken < numItems) {
+        int value;
+        if (deque.steal(value)) {
+          sum += value;
+          taken++;
+        }
+      }
+    });
+  }
+
+  for (int i = 0; i < numItems; ++i) {
+    deque.push(i);
+    int value;
+    if (i % 3 == 0 && deque.pop(value)) {
+      sum += value;
+      taken++;
+    }
+  }
+  int value;
+  while (deque.pop(value)) {
+    sum += value;
+    taken++;
+  }
+
+  for (auto& t : thieves) {
+    t.join();
+  }
+  EXPECT_EQ(taken, numItems);
+  EXPECT_EQ(sum, static_cast<long>(numItems) * (numItems - 1) / 2);
+}
+
 int main(int argc, char* argv[]) {
   testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
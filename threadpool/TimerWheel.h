@@ -0,0 +1,342 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "Task.h"
+
+// Identifies a pending timer, for cancelling it. Stays safe to use after the
+// timer fired or was cancelled: it just no longer matches anything.
+struct TimerId {
+  void* node{nullptr};
+  uint32_t generation{0};
+};
+
+// Hierarchical timing wheel, as in Varghese and Lauck's "Hashed and
+// Hierarchical Timing Wheels". Time is counted in ticks. Level 0 has a slot
+// per tick for the next 256 ticks, level 1 a slot per 256 ticks for the next
+// 65536, and so on. A timer goes into the finest level that covers it, and
+// moves down a level ("cascades") whenever the level below wraps around.
+// Each slot is an intrusive doubly-linked list, so adding and cancelling a
+// timer are O(1), and a tick only looks at the slots that are due.
+//
+// The levels cover 2^32 ticks (about 49 days at 1ms). Timers further out than
+// that wait in the top level, and are placed again, at their true deadline,
+// whenever their slot there comes up. So any deadline works, it just
+// cascades a few more times.
+//
+// Not thread-safe: TimerService below wraps it with a lock and a thread.
+class TimerWheel {
+  static constexpr unsigned kLevels = 4;
+  static constexpr unsigned kBits = 8;
+  static constexpr uint64_t kSlots = 1 << kBits;
+  static constexpr uint64_t kMask = kSlots - 1;
+  static constexpr uint64_t kMaxDelay = (uint64_t{1} << (kLevels * kBits)) - 1;
+  static constexpr size_t kChunkSize = 256;
+
+  struct Node {
+    Task task;
+    // Runs of a periodic timer share the callable
+    std::shared_ptr<Task> repeat;
+    uint64_t deadline{0};
+    uint64_t period{0};
+    Node* prev{nullptr};
+    Node* next{nullptr};
+    uint32_t generation{0};
+    bool linked{false};
+  };
+
+  // A slot's list, with a dummy head so that unlinking needs no branches
+  struct Slot {
+    Node head;
+    Slot() { head.prev = head.next = &head; }
+    bool empty() const { return head.next == &head; }
+  };
+
+  std::array<std::array<Slot, kSlots>, kLevels> slots_;
+  // Which slots are non-empty, so we can find the next due one quickly
+  std::array<std::array<uint64_t, kSlots / 64>, kLevels> occupied_{};
+  uint64_t now_{0};  // The next tick to process
+  size_t size_{0};
+  Node* free_{nullptr};
+  std::vector<std::unique_ptr<Node[]>> chunks_;
+
+  Node* allocate() {
+    if (!free_) {
+      chunks_.emplace_back(new Node[kChunkSize]);
+      auto* chunk = chunks_.back().get();
+      for (size_t n = 0; n != kChunkSize; ++n) {
+        chunk[n].next = n + 1 != kChunkSize ? &chunk[n + 1] : nullptr;
+      }
+      free_ = chunk;
+    }
+    auto* node = free_;
+    free_ = node->next;
+    return node;
+  }
+
+  void release(Node* node) {
+    node->task = Task{};
+    node->repeat.reset();
+    ++node->generation;
+    node->next = free_;
+    free_ = node;
+  }
+
+  void link(Node* node) {
+    const auto delay = std::min(node->deadline - now_, kMaxDelay);
+    unsigned level = 0;
+    while (delay >> (kBits * (level + 1)) != 0) {
+      ++level;
+    }
+    const auto index = ((now_ + delay) >> (kBits * level)) & kMask;
+    auto& head = slots_[level][index].head;
+    node->prev = &head;
+    node->next = head.next;
+    head.next->prev = node;
+    head.next = node;
+    node->linked = true;
+    occupied_[level][index / 64] |= uint64_t{1} << (index % 64);
+  }
+
+  void unlink(Node* node) {
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    node->linked = false;
+  }
+
+  // Takes every timer out of a slot, so we can either cascade or fire them.
+  Node* take(unsigned level, uint64_t index) {
+    auto& slot = slots_[level][index];
+    occupied_[level][index / 64] &= ~(uint64_t{1} << (index % 64));
+    if (slot.empty()) {
+      return nullptr;
+    }
+    auto* first = slot.head.next;
+    slot.head.prev->next = nullptr;
+    slot.head.prev = slot.head.next = &slot.head;
+    return first;
+  }
+
+  // The first tick, at or after now_, at which an occupied slot of 'level'
+  // comes up: fires, for level 0, or cascades. UINT64_MAX if there's none.
+  uint64_t nextInLevel(unsigned level) const {
+    const auto shift = kBits * level;
+    // The current slot already came up, unless we're at its very start.
+    auto first = now_ >> shift;
+    if ((now_ & ((uint64_t{1} << shift) - 1)) != 0) {
+      ++first;
+    }
+    const auto start = first & kMask;
+    for (uint64_t n = 0; n <= kSlots / 64; ++n) {
+      const auto word = (start / 64 + n) % (kSlots / 64);
+      auto bits = occupied_[level][word];
+      if (n == 0) {
+        bits &= ~uint64_t{0} << (start % 64);
+      } else if (n == kSlots / 64) {
+        bits &= ~(~uint64_t{0} << (start % 64));
+      }
+      if (bits) {
+        const auto index = word * 64 + std::countr_zero(bits);
+        return (first + ((index - start) & kMask)) << shift;
+      }
+    }
+    return UINT64_MAX;
+  }
+
+ public:
+  TimerWheel() = default;
+
+  // Avoid copying
+  TimerWheel(const TimerWheel&) = delete;
+  TimerWheel& operator=(const TimerWheel&) = delete;
+
+  size_t size() const { return size_; }
+
+  uint64_t now() const { return now_; }
+
+  // Adds a timer that fires at tick 'deadline' (or at the next tick, if that
+  // has passed), and then every 'period' ticks if that's not 0.
+  TimerId add(uint64_t deadline, Task&& task, uint64_t period = 0) {
+    auto* node = allocate();
+    node->deadline = std::max(deadline, now_);
+    node->period = period;
+    if (period != 0) {
+      node->repeat = std::make_shared<Task>(std::move(task));
+    } else {
+      node->task = std::move(task);
+    }
+    link(node);
+    ++size_;
+    return {node, node->generation};
+  }
+
+  // Returns false if the timer already fired (for the last time) or was
+  // cancelled.
+  bool cancel(TimerId id) {
+    auto* node = static_cast<Node*>(id.node);
+    if (!node || node->generation != id.generation || !node->linked) {
+      return false;
+    }
+    unlink(node);
+    release(node);
+    --size_;
+    return true;
+  }
+
+  // The first tick that has work to do, at or after now(). Only meaningful if
+  // size() != 0.
+  uint64_t next() const {
+    auto tick = nextInLevel(0);
+    for (unsigned level = 1; level != kLevels; ++level) {
+      tick = std::min(tick, nextInLevel(level));
+    }
+    return tick;
+  }
+
+  // Processes every tick up to and including 'tick', and appends the tasks
+  // of the timers that fired to 'expired'.
+  void advance(uint64_t tick, std::vector<Task>& expired) {
+    while (size_ != 0 && now_ <= tick) {
+      const auto due = next();
+      if (due > tick) {
+        break;
+      }
+      now_ = due;
+      // Cascade from the top down, so that timers can fall through more
+      // than one level at once.
+      for (unsigned level = kLevels - 1; level != 0; --level) {
+        if ((now_ & ((uint64_t{1} << (kBits * level)) - 1)) != 0) {
+          continue;
+        }
+        const auto index = (now_ >> (kBits * level)) & kMask;
+        for (auto* node = take(level, index); node;) {
+          auto* next = node->next;
+          link(node);
+          node = next;
+        }
+      }
+      for (auto* node = take(0, now_ & kMask); node;) {
+        auto* next = node->next;
+        node->linked = false;
+        if (node->period != 0) {
+          expired.emplace_back([repeat = node->repeat] { (*repeat)(); });
+          node->deadline = now_ + std::min(node->period, UINT64_MAX - now_);
+          link(node);
+        } else {
+          expired.push_back(std::move(node->task));
+          release(node);
+          --size_;
+        }
+        node = next;
+      }
+      ++now_;
+    }
+    now_ = std::max(now_, tick + 1);
+  }
+};
+
+// A TimerWheel with a thread that runs it. Expired timers are handed over in
+// batches to 'dispatch', which runs on the timer thread and is expected to
+// pass them on to something else right away.
+class TimerService {
+  using Clock = std::chrono::steady_clock;
+
+  const Clock::duration tick_;
+  const Clock::time_point start_{Clock::now()};
+  std::function<void(std::vector<Task>&)> dispatch_;
+  TimerWheel wheel_;
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  bool done_{false};
+  std::thread thread_;
+
+  uint64_t ticks(Clock::time_point t) const {
+    return static_cast<uint64_t>((t - start_) / tick_);
+  }
+
+  // Ticks in d, rounded up, so that timers never fire early
+  uint64_t ticks(Clock::duration d) const {
+    return static_cast<uint64_t>((std::max(d, Clock::duration::zero()) +
+                                  tick_ - Clock::duration(1)) /
+                                 tick_);
+  }
+
+  void run() {
+    std::vector<Task> expired;
+    std::unique_lock<std::mutex> lock{mutex_};
+    while (!done_) {
+      wheel_.advance(ticks(Clock::now()), expired);
+      if (!expired.empty()) {
+        lock.unlock();
+        dispatch_(expired);
+        expired.clear();
+        lock.lock();
+        continue;
+      }
+      if (wheel_.size() == 0) {
+        changed_.wait(lock);
+      } else {
+        changed_.wait_until(lock, start_ + wheel_.next() * tick_);
+      }
+    }
+  }
+
+ public:
+  explicit TimerService(
+      std::function<void(std::vector<Task>&)> dispatch,
+      Clock::duration tick = std::chrono::milliseconds(1))
+      : tick_(tick), dispatch_(std::move(dispatch)) {
+    thread_ = std::thread([this] { run(); });
+  }
+
+  // Timers that haven't fired are dropped.
+  ~TimerService() {
+    {
+      std::lock_guard<std::mutex> lock{mutex_};
+      done_ = true;
+    }
+    changed_.notify_one();
+    thread_.join();
+  }
+
+  TimerId add(Clock::duration delay, Task&& task,
+              Clock::duration period = Clock::duration::zero()) {
+    // Deadlines are in ticks of the wheel, counted from the next tick it
+    // processes, so that a timer never fires early.
+    const auto now = Clock::now();
+    std::lock_guard<std::mutex> lock{mutex_};
+    const auto base = std::max(wheel_.now(), ticks(now) + 1);
+    const bool wake = wheel_.size() == 0 || base + ticks(delay) < wheel_.next();
+    auto id = wheel_.add(base + ticks(delay), std::move(task),
+                         period > Clock::duration::zero()
+                             ? std::max<uint64_t>(1, ticks(period))
+                             : 0);
+    if (wake) {
+      // It's due before anything the thread is waiting for.
+      changed_.notify_one();
+    }
+    return id;
+  }
+
+  bool cancel(TimerId id) {
+    std::lock_guard<std::mutex> lock{mutex_};
+    return wheel_.cancel(id);
+  }
+
+  size_t size() {
+    std::lock_guard<std::mutex> lock{mutex_};
+    return wheel_.size();
+  }
+};
@@ -0,0 +1,266 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cstddef>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// Where each CPU sits in the machine, as far as sharing goes: which CPUs are
+// hyper-threads of the same core, which share a last-level cache, and which
+// are on the same NUMA node. On Linux it comes from /sys/devices/system/cpu;
+// anywhere else (or if that isn't readable), every CPU is a core of its own in
+// one big cache and node.
+class Topology {
+ public:
+  struct Cpu {
+    unsigned id;
+    // Ids of the groups the CPU belongs to, e.g., the lowest CPU in the group
+    unsigned core;
+    unsigned llc;
+    unsigned node;
+  };
+
+ private:
+  // Sorted so that CPUs that share the most are next to each other
+  std::vector<Cpu> cpus_;
+
+  static std::string readLine(const std::filesystem::path& path) {
+    std::ifstream in(path);
+    std::string line;
+    std::getline(in, line);
+    return line;
+  }
+
+  // The lowest CPU in a cpu list file, used as the id of the group
+  static unsigned groupOf(const std::filesystem::path& path, unsigned cpu) {
+    const auto cpus = parseList(readLine(path));
+    return cpus.empty() ? cpu : cpus.front();
+  }
+
+  static Cpu readCpu(const std::filesystem::path& root, unsigned id) {
+    namespace fs = std::filesystem;
+    const auto dir = root / ("cpu" + std::to_string(id));
+    std::error_code ec;
+    Cpu cpu{id, id, 0, 0};
+    cpu.core = groupOf(dir / "topology" / "thread_siblings_list", id);
+    // The LLC is the highest level cache that holds data.
+    unsigned level = 0;
+    for (auto& e : fs::directory_iterator(dir / "cache", ec)) {
+      if (e.path().filename().string().rfind("index", 0) != 0 ||
+          readLine(e.path() / "type") == "Instruction") {
+        continue;
+      }
+      const auto l = static_cast<unsigned>(
+          std::atoi(readLine(e.path() / "level").c_str()));
+      if (l > level) {
+        level = l;
+        cpu.llc = groupOf(e.path() / "shared_cpu_list", id);
+      }
+    }
+    // The node shows up as a nodeN link in the CPU's directory.
+    for (auto& e : fs::directory_iterator(dir, ec)) {
+      const auto name = e.path().filename().string();
+      if (name.size() > 4 && name.rfind("node", 0) == 0 &&
+          std::all_of(name.begin() + 4, name.end(), [](unsigned char c) {
+            return std::isdigit(c);
+          })) {
+        cpu.node = static_cast<unsigned>(std::atoi(name.c_str() + 4));
+      }
+    }
+    return cpu;
+  }
+
+  // CPUs this process is allowed to run on
+  static bool allowed(unsigned cpu) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0 && cpu < CPU_SETSIZE) {
+      return CPU_ISSET(cpu, &set);
+    }
+#endif
+    (void)cpu;
+    return true;
+  }
+
+ public:
+  explicit Topology(std::vector<Cpu> cpus) : cpus_(std::move(cpus)) {
+    std::sort(cpus_.begin(), cpus_.end(), [](const Cpu& a, const Cpu& b) {
+      return std::tie(a.node, a.llc, a.core, a.id) <
+             std::tie(b.node, b.llc, b.core, b.id);
+    });
+  }
+
+  // Reads the layout of the CPUs we may run on.
+  static Topology detect(
+      const std::filesystem::path& root = "/sys/devices/system/cpu") {
+    std::vector<Cpu> cpus;
+    for (auto id : parseList(readLine(root / "online"))) {
+      if (allowed(id)) {
+        cpus.push_back(readCpu(root, id));
+      }
+    }
+    if (cpus.empty()) {
+      return uniform(std::thread::hardware_concurrency());
+    }
+    return Topology(std::move(cpus));
+  }
+
+  // n CPUs that are all equally close to each other
+  static Topology uniform(unsigned n) {
+    std::vector<Cpu> cpus;
+    for (unsigned id = 0; id != std::max(1u, n); ++id) {
+      cpus.push_back({id, id, 0, 0});
+    }
+    return Topology(std::move(cpus));
+  }
+
+  // Parses the kernel's cpu list format, e.g., "0-3,8,10-11".
+  static std::vector<unsigned> parseList(const std::string& list) {
+    std::vector<unsigned> cpus;
+    size_t pos = 0;
+    while (pos < list.size()) {
+      auto end = list.find(',', pos);
+      if (end == std::string::npos) {
+        end = list.size();
+      }
+      const auto item = list.substr(pos, end - pos);
+      const auto dash = item.find('-');
+      if (!item.empty() && std::isdigit(static_cast<unsigned char>(item[0]))) {
+        const auto lo = static_cast<unsigned>(std::stoul(item));
+        auto hi = lo;
+        if (dash != std::string::npos) {
+          hi = static_cast<unsigned>(std::stoul(item.substr(dash + 1)));
+        }
+        for (auto cpu = lo; cpu <= hi; ++cpu) {
+          cpus.push_back(cpu);
+        }
+      }
+      pos = end + 1;
+    }
+    return cpus;
+  }
+
+  // Parses a cgroup v2 cpu.max ("max 100000" or "150000 100000") into the
+  // number of CPUs the quota is worth, rounded up. 0 means no limit.
+  static unsigned quotaCpus(const std::string& cpuMax) {
+    if (cpuMax.empty() ||
+        !std::isdigit(static_cast<unsigned char>(cpuMax[0]))) {
+      return 0;
+    }
+    const auto quota = std::stoull(cpuMax);
+    const auto space = cpuMax.find(' ');
+    unsigned long long period = 100000;
+    if (space != std::string::npos) {
+      period = std::stoull(cpuMax.substr(space));
+    }
+    if (period == 0) {
+      return 0;
+    }
+    return static_cast<unsigned>(std::max<unsigned long long>(
+        1, (quota + period - 1) / period));
+  }
+
+  // How many threads can actually run at once: the CPUs we may run on, capped
+  // by the CPU quota of our cgroup (or of any group above it), if any.
+  static unsigned availableCpus(
+      const std::filesystem::path& cgroup = "/sys/fs/cgroup") {
+    unsigned cpus = std::max(1u, std::thread::hardware_concurrency());
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+      cpus = static_cast<unsigned>(std::max(1, CPU_COUNT(&set)));
+    }
+#endif
+    // Lines look like "0::/path" for v2 and "4:cpu,cpuacct:/path" for v1.
+    std::ifstream self("/proc/self/cgroup");
+    std::string line;
+    unsigned quota = 0;
+    while (std::getline(self, line)) {
+      const auto first = line.find(':');
+      const auto second = line.find(':', first + 1);
+      if (first == std::string::npos || second == std::string::npos) {
+        continue;
+      }
+      const auto controllers = line.substr(first + 1, second - first - 1);
+      const std::filesystem::path group = line.substr(second + 2);
+      std::filesystem::path dir;
+      if (controllers.empty()) {
+        dir = cgroup / group;
+      } else if (("," + controllers + ",").find(",cpu,") != std::string::npos) {
+        dir = cgroup / controllers / group;
+      } else {
+        continue;
+      }
+      for (;; dir = dir.parent_path()) {
+        auto q = quotaCpus(readLine(dir / "cpu.max"));
+        const auto cfsQuota = readLine(dir / "cpu.cfs_quota_us");
+        if (q == 0 && !cfsQuota.empty() && cfsQuota[0] != '-') {
+          q = quotaCpus(cfsQuota + " " + readLine(dir / "cpu.cfs_period_us"));
+        }
+        if (q != 0 && (quota == 0 || q < quota)) {
+          quota = q;
+        }
+        if (dir.native().size() <= cgroup.native().size()) {
+          break;
+        }
+      }
+    }
+    return quota != 0 ? std::min(cpus, quota) : cpus;
+  }
+
+  size_t size() const { return cpus_.size(); }
+
+  // The CPU for worker i. Consecutive workers get CPUs that share the most.
+  const Cpu& cpu(unsigned i) const { return cpus_[i % cpus_.size()]; }
+
+  // 0 for SMT siblings, 1 for a shared LLC, 2 for the same node, 3 otherwise
+  static unsigned distance(const Cpu& a, const Cpu& b) {
+    if (a.core == b.core && a.node == b.node) {
+      return 0;
+    }
+    if (a.llc == b.llc && a.node == b.node) {
+      return 1;
+    }
+    return a.node == b.node ? 2 : 3;
+  }
+
+  // The order in which worker i should look at the other n - 1 workers: the
+  // closest first, and round-robin among workers that are equally close, so
+  // that not everybody goes after the same victim.
+  std::vector<unsigned> victims(unsigned i, unsigned n) const {
+    std::vector<unsigned> order;
+    for (unsigned k = 1; k != n; ++k) {
+      order.push_back((i + k) % n);
+    }
+    std::stable_sort(order.begin(), order.end(), [&](unsigned a, unsigned b) {
+      return distance(cpu(i), cpu(a)) < distance(cpu(i), cpu(b));
+    });
+    return order;
+  }
+
+  // Pins the calling thread to worker i's CPU. Returns false if it can't.
+  bool pin(unsigned i) const {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu(i).id, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    (void)i;
+    return false;
+#endif
+  }
+};
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+// Lock-free work-stealing deque, as described by Chase and Lev in "Dynamic
+// Circular Work-Stealing Deque" and adapted to the C11 memory model by Lê et al.
+// in "Correct and Efficient Work-Stealing for Weak Memory Models".
+//
+// Only the owner thread may call push() and pop(), which work at the bottom of
+// the deque (LIFO). Any other thread may call steal(), which takes elements
+// from the top (FIFO) with a single CAS.
+//
+// Thieves read a slot before they know whether they won it, so T must be
+// trivially copyable (in practice, a pointer to the actual task).
+template <typename T>
+class WorkStealingDeque {
+  static_assert(std::is_trivially_copyable_v<T>,
+                "WorkStealingDeque elements must be trivially copyable");
+
+#ifdef __cpp_lib_hardware_interference_size
+  static constexpr size_t kCacheLineSize =
+      std::hardware_destructive_interference_size;
+#else
+  static constexpr size_t kCacheLineSize = 64;
+#endif
+
+  // Circular array whose capacity is always a power of two
+  struct Array {
+    const int64_t capacity;
+    const int64_t mask;
+    std::unique_ptr<std::atomic<T>[]> slots;
+
+    explicit Array(int64_t cap)
+        : capacity(cap), mask(cap - 1), slots(new std::atomic<T>[cap]) {}
+
+    T get(int64_t i) const {
+      return slots[i & mask].load(std::memory_order_relaxed);
+    }
+
+    void put(int64_t i, T x) {
+      slots[i & mask].store(x, std::memory_order_relaxed);
+    }
+  };
+
+  alignas(kCacheLineSize) std::atomic<int64_t> top_{0};
+  alignas(kCacheLineSize) std::atomic<int64_t> bottom_{0};
+  alignas(kCacheLineSize) std::atomic<Array*> array_;
+
+  // Arrays we outgrew. A thief may still be reading from one of them, so we
+  // only release them when the deque itself goes away.
+  std::vector<std::unique_ptr<Array>> arrays_;
+
+  Array* grow(Array* a, int64_t top, int64_t bottom) {
+    auto bigger = std::make_unique<Array>(a->capacity * 2);
+    for (int64_t i = top; i != bottom; ++i) {
+      bigger->put(i, a->get(i));
+    }
+    arrays_.push_back(std::move(bigger));
+    return arrays_.back().get();
+  }
+
+ public:
+  typedef T value_type;
+
+  explicit WorkStealingDeque(int64_t capacity = 256) {
+    assert(capacity > 0 && (capacity & (capacity - 1)) == 0);
+    arrays_.push_back(std::make_unique<Array>(capacity));
+    array_.store(arrays_.back().get(), std::memory_order_relaxed);
+  }
+
+  // Avoid copying
+  WorkStealingDeque(const WorkStealingDeque&) = delete;
+  WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+  // Owner only.
+  void push(T x) {
+    const auto b = bottom_.load(std::memory_order_relaxed);
+    const auto t = top_.load(std::memory_order_acquire);
+    auto* a = array_.load(std::memory_order_relaxed);
+    if (b - t > a->capacity - 1) {
+      a = grow(a, t, b);
+      array_.store(a, std::memory_order_release);
+    }
+    a->put(b, x);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom_.store(b + 1, std::memory_order_relaxed);
+  }
+
+  // Owner only. Takes the most recently pushed element.
+  bool pop(T& x) {
+    const auto b = bottom_.load(std::memory_order_relaxed) - 1;
+    auto* a = array_.load(std::memory_order_relaxed);
+    bottom_.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    auto t = top_.load(std::memory_order_relaxed);
+    if (t > b) {
+      // The deque is empty
+      bottom_.store(b + 1, std::memory_order_relaxed);
+      return false;
+    }
+    x = a->get(b);
+    if (t == b) {
+      // This is the last element, so we race against the thieves for it.
+      const bool won = top_.compare_exchange_strong(
+          t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+      bottom_.store(b + 1, std::memory_order_relaxed);
+      return won;
+    }
+    return true;
+  }
+
+  // Any thread. Takes the least recently pushed element. A false return means
+  // the deque was empty or we lost a race with another thread; the caller can
+  // just move on to another victim.
+  bool steal(T& x) {
+    auto t = top_.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    const auto b = bottom_.load(std::memory_order_acquire);
+    if (t >= b) {
+      return false;
+    }
+    auto* a = array_.load(std::memory_order_acquire);
+    x = a->get(t);
+    return top_.compare_exchange_strong(
+        t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+  }
+
+  // Only a hint when called concurrently with push(), pop() or steal().
+  bool empty() const {
+    return bottom_.load(std::memory_order_relaxed) <=
+           top_.load(std::memory_order_relaxed);
+  }
+
+  size_t sizeEstimate() const {
+    const auto n = bottom_.load(std::memory_order_relaxed) -
+                   top_.load(std::memory_order_relaxed);
+    return n > 0 ? static_cast<size_t>(n) : 0;
+  }
+};